@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""End-to-end load test of streetview_downloader against the local mock tile server.
+
+Starts the mock server, runs the real binary over a batch of synthetic PanoIDs and
+reports panoramas/sec, tiles/sec, p50/p99 per-panorama latency and peak RSS as JSON.
+Per-panorama latency is taken from the --trace timeline: first to last span of each PanoID.
+
+Example:
+    python3 bench/load_test.py --binary build/streetview_downloader \\
+        --bench-binary build/streetview_bench --panoramas 50 --latency-ms 40 -- -p 8 --no-directional
+"""
+
+import argparse
+import json
+import os
+import random
+import resource
+import string
+import subprocess
+import sys
+import tempfile
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+import mock_tile_server  # noqa: E402
+
+
+def percentile(values, fraction):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, max(0, int(round(fraction * (len(ordered) - 1)))))
+    return ordered[index]
+
+
+def panorama_latencies(trace_path):
+    """Seconds from the first to the last traced span of each PanoID, and which PanoIDs were stitched."""
+    with open(trace_path, "rb") as f:
+        events = json.load(f)["traceEvents"]
+    extents = {}
+    stitched = set()
+    for event in events:
+        panoid = event.get("args", {}).get("panoid")
+        if not panoid:
+            continue
+        start = event["ts"]
+        end = start + event["dur"]
+        first, last = extents.get(panoid, (start, end))
+        extents[panoid] = (min(first, start), max(last, end))
+        if event["name"] == "stitch_panorama":
+            stitched.add(panoid)
+    return {p: (e[1] - e[0]) / 1e6 for p, e in extents.items()}, stitched
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--binary", required=True, help="path to streetview_downloader")
+    parser.add_argument("--bench-binary", help="path to streetview_bench, used to create fixtures if missing")
+    parser.add_argument("--panoramas", type=int, default=20, help="number of synthetic PanoIDs")
+    parser.add_argument("--work-dir", help="directory for input, output and trace (default: temporary)")
+    parser.add_argument("--output", help="write the JSON report here as well as to stdout")
+    parser.add_argument("downloader_args", nargs="*", help="extra arguments for the downloader, after --")
+    mock_tile_server.add_server_arguments(parser, fixtures_required=False)
+    args = parser.parse_args()
+
+    work_dir = args.work_dir or tempfile.mkdtemp(prefix="streetview_load_")
+    os.makedirs(work_dir, exist_ok=True)
+
+    if args.fixtures is None:
+        args.fixtures = os.path.join(work_dir, "fixtures")
+    if not os.path.exists(os.path.join(args.fixtures, "tile_0.jpg")):
+        if not args.bench_binary:
+            parser.error("no fixtures in %s; pass --fixtures or --bench-binary" % args.fixtures)
+        subprocess.run([args.bench_binary, "--write-fixtures", args.fixtures], check=True)
+
+    server, stats = mock_tile_server.start_server(mock_tile_server.config_from_arguments(args))
+    host = "http://%s:%d" % server.server_address
+
+    rng = random.Random(args.seed)
+    alphabet = string.ascii_letters + string.digits + "-_"
+    panoids = ["".join(rng.choice(alphabet) for _ in range(22)) for _ in range(args.panoramas)]
+    input_path = os.path.join(work_dir, "panoids.csv")
+    with open(input_path, "w") as f:
+        f.write("panoid\n")
+        f.writelines(p + "\n" for p in panoids)
+
+    trace_path = os.path.join(work_dir, "trace.json")
+    command = [args.binary, "-f", input_path, "-o", os.path.join(work_dir, "output"),
+               "--tile-host", host, "--trace", trace_path, "--no-skip"] + args.downloader_args
+
+    with open(os.path.join(work_dir, "downloader.out"), "wb") as log:
+        start = time.monotonic()
+        result = subprocess.run(command, stdout=log, stderr=subprocess.STDOUT, cwd=work_dir)
+        elapsed = time.monotonic() - start
+    server.shutdown()
+
+    # ru_maxrss is in kilobytes on Linux and bytes on macOS
+    peak_rss = resource.getrusage(resource.RUSAGE_CHILDREN).ru_maxrss
+    peak_rss_mb = peak_rss / (1024.0 * 1024.0) if sys.platform == "darwin" else peak_rss / 1024.0
+
+    latencies, stitched = panorama_latencies(trace_path) if os.path.exists(trace_path) else ({}, set())
+    completed = [latencies[p] for p in stitched]
+    served = stats.snapshot()
+
+    report = {
+        "exit_code": result.returncode,
+        "panoramas": len(panoids),
+        "panoramas_stitched": len(stitched),
+        "wall_seconds": round(elapsed, 3),
+        "panoramas_per_second": round(len(stitched) / elapsed, 3) if elapsed > 0 else 0.0,
+        "tiles_per_second": round(served["tiles_served"] / elapsed, 1) if elapsed > 0 else 0.0,
+        "panorama_latency_p50_seconds": round(percentile(completed, 0.50), 3),
+        "panorama_latency_p99_seconds": round(percentile(completed, 0.99), 3),
+        "peak_rss_mb": round(peak_rss_mb, 1),
+        "server": served,
+        "work_dir": work_dir,
+    }
+
+    text = json.dumps(report, indent=2)
+    print(text)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    return 0 if result.returncode == 0 else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
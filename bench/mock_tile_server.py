@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Street View tile service, for repeatable load tests.
+
+Serves fixture JPEG tiles on /v1/tile with the same query parameters as the real
+service, with optional latency, per-response bandwidth caps, 404/429/5xx injection
+and blank tiles. Run the downloader against it with --tile-host http://127.0.0.1:PORT.
+
+Fixture tiles can be generated with: streetview_bench --write-fixtures DIR
+"""
+
+import argparse
+import glob
+import hashlib
+import json
+import os
+import random
+import threading
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from urllib.parse import parse_qs, urlparse
+
+# Tile grid of each generation at its native zoom level, as probed by the downloader
+GENERATIONS = {
+    1: (3, 8, 4),
+    2: (4, 13, 6),
+    3: (4, 13, 7),
+    4: (4, 16, 8),
+}
+
+
+class MockConfig:
+    def __init__(self, fixtures_dir, generation=4, latency_ms=0.0, latency_jitter_ms=0.0,
+                 bandwidth_kbps=0.0, rate_404=0.0, rate_429=0.0, rate_5xx=0.0, blank_rate=0.0, seed=1):
+        self.tiles = [open(p, "rb").read() for p in sorted(glob.glob(os.path.join(fixtures_dir, "tile_*.jpg")))]
+        blank_path = os.path.join(fixtures_dir, "blank.jpg")
+        self.blank = open(blank_path, "rb").read() if os.path.exists(blank_path) else None
+        if not self.tiles:
+            raise RuntimeError("no tile_*.jpg fixtures in " + fixtures_dir)
+        if blank_rate > 0 and self.blank is None:
+            raise RuntimeError("blank tile injection needs blank.jpg in " + fixtures_dir)
+
+        self.generation = generation
+        self.latency_ms = latency_ms
+        self.latency_jitter_ms = latency_jitter_ms
+        self.bandwidth_kbps = bandwidth_kbps
+        self.rate_404 = rate_404
+        self.rate_429 = rate_429
+        self.rate_5xx = rate_5xx
+        self.blank_rate = blank_rate
+        self.seed = seed
+
+
+class MockStats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.responses = {}
+        self.tiles_served = 0
+        self.blank_served = 0
+        self.bytes_sent = 0
+
+    def record(self, status, body_bytes=0, tile=False, blank=False):
+        with self.lock:
+            self.responses[status] = self.responses.get(status, 0) + 1
+            self.bytes_sent += body_bytes
+            self.tiles_served += 1 if tile else 0
+            self.blank_served += 1 if blank else 0
+
+    def snapshot(self):
+        with self.lock:
+            return {
+                "responses": {str(k): v for k, v in sorted(self.responses.items())},
+                "tiles_served": self.tiles_served,
+                "blank_served": self.blank_served,
+                "bytes_sent": self.bytes_sent,
+            }
+
+
+def tile_fraction(seed, salt, panoid, zoom, x, y):
+    """Stable value in [0, 1) per tile, so permanent faults survive retries."""
+    key = "%d:%s:%s:%d:%d:%d" % (seed, salt, panoid, zoom, x, y)
+    return int.from_bytes(hashlib.blake2b(key.encode(), digest_size=8).digest(), "little") / 2.0 ** 64
+
+
+def grid_size(generation, zoom):
+    """Tile grid served at zoom, or (0, 0) when the generation has no such level.
+
+    Only the native level is served; answering other zoom levels would let the generation
+    probes of a newer generation succeed.
+    """
+    native_zoom, cols, rows = GENERATIONS[generation]
+    if zoom == native_zoom:
+        return cols, rows
+    return 0, 0
+
+
+class TileHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    config = None
+    stats = None
+
+    def log_message(self, format, *args):
+        pass
+
+    def send_body(self, status, body, content_type):
+        self.send_response(status)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+
+        config = self.config
+        if config.bandwidth_kbps > 0 and body:
+            # Pace the body in small chunks to emulate a capped link
+            chunk = 8192
+            seconds_per_chunk = chunk / (config.bandwidth_kbps * 1024.0)
+            for offset in range(0, len(body), chunk):
+                self.wfile.write(body[offset:offset + chunk])
+                time.sleep(seconds_per_chunk)
+        else:
+            self.wfile.write(body)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        if url.path == "/stats":
+            self.send_body(200, json.dumps(self.stats.snapshot()).encode(), "application/json")
+            return
+        if url.path != "/v1/tile":
+            self.stats.record(404)
+            self.send_body(404, b"", "text/plain")
+            return
+
+        query = parse_qs(url.query)
+        try:
+            panoid = query["panoid"][0]
+            zoom = int(query["zoom"][0])
+            x = int(query["x"][0])
+            y = int(query["y"][0])
+        except (KeyError, ValueError):
+            self.stats.record(400)
+            self.send_body(400, b"", "text/plain")
+            return
+
+        config = self.config
+        delay = config.latency_ms
+        if config.latency_jitter_ms > 0:
+            delay += random.uniform(0, config.latency_jitter_ms)
+        if delay > 0:
+            time.sleep(delay / 1000.0)
+
+        cols, rows = grid_size(config.generation, zoom)
+        if x < 0 or y < 0 or x >= cols or y >= rows or \
+                tile_fraction(config.seed, "404", panoid, zoom, x, y) < config.rate_404:
+            self.stats.record(404)
+            self.send_body(404, b"", "text/plain")
+            return
+
+        # Throttling and server errors are transient, so they are drawn per request
+        roll = random.random()
+        if roll < config.rate_429:
+            self.stats.record(429)
+            self.send_body(429, b"", "text/plain")
+            return
+        if roll < config.rate_429 + config.rate_5xx:
+            status = random.choice((500, 502, 503))
+            self.stats.record(status)
+            self.send_body(status, b"", "text/plain")
+            return
+
+        if tile_fraction(config.seed, "blank", panoid, zoom, x, y) < config.blank_rate:
+            self.stats.record(200, len(config.blank), blank=True)
+            self.send_body(200, config.blank, "image/jpeg")
+            return
+
+        index = int(tile_fraction(config.seed, "tile", panoid, zoom, x, y) * len(config.tiles))
+        body = config.tiles[index]
+        self.stats.record(200, len(body), tile=True)
+        self.send_body(200, body, "image/jpeg")
+
+
+class MockServer(ThreadingHTTPServer):
+    daemon_threads = True
+    # The downloader opens many connections at once; the default backlog of 5 drops them
+    request_queue_size = 1024
+
+
+def start_server(config, host="127.0.0.1", port=0):
+    """Start the mock server on a background thread; returns (server, stats)."""
+    stats = MockStats()
+    handler = type("BoundTileHandler", (TileHandler,), {"config": config, "stats": stats})
+    server = MockServer((host, port), handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server, stats
+
+
+def add_server_arguments(parser, fixtures_required=True):
+    parser.add_argument("--fixtures", required=fixtures_required, help="directory with tile_*.jpg and blank.jpg")
+    parser.add_argument("--generation", type=int, default=4, choices=sorted(GENERATIONS))
+    parser.add_argument("--latency-ms", type=float, default=0.0, help="fixed delay before each response")
+    parser.add_argument("--latency-jitter-ms", type=float, default=0.0, help="extra uniform random delay")
+    parser.add_argument("--bandwidth-kbps", type=float, default=0.0, help="per-response bandwidth cap (0 = off)")
+    parser.add_argument("--rate-404", type=float, default=0.0, help="fraction of tiles that are permanently missing")
+    parser.add_argument("--rate-429", type=float, default=0.0, help="fraction of requests throttled with 429")
+    parser.add_argument("--rate-5xx", type=float, default=0.0, help="fraction of requests failing with 5xx")
+    parser.add_argument("--blank-rate", type=float, default=0.0, help="fraction of tiles served as blank")
+    parser.add_argument("--seed", type=int, default=1)
+
+
+def config_from_arguments(args):
+    random.seed(args.seed)
+    return MockConfig(args.fixtures, args.generation, args.latency_ms, args.latency_jitter_ms,
+                      args.bandwidth_kbps, args.rate_404, args.rate_429, args.rate_5xx, args.blank_rate, args.seed)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    add_server_arguments(parser)
+    args = parser.parse_args()
+
+    server, stats = start_server(config_from_arguments(args), args.host, args.port)
+    print("Serving tiles on http://%s:%d (stats on /stats)" % server.server_address, flush=True)
+    try:
+        while True:
+            time.sleep(3600)
+    except KeyboardInterrupt:
+        server.shutdown()
+        print(json.dumps(stats.snapshot(), indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,358 @@
+// Microbenchmarks for the CPU hot paths of the downloader, on synthetic data only (no network).
+// Results are printed as JSON so runs can be stored and compared across builds and machines.
+//
+// Usage: streetview_bench [--quick] [--filter NAME] [--output FILE]
+//        streetview_bench --write-fixtures DIR   (tiles for bench/mock_tile_server.py)
+
+#include "../streetview_downloader.cpp"
+
+// Timing summary of one benchmark
+struct BenchmarkResult {
+    std::string name;
+    int iterations = 0;
+    double mean_ns = 0;
+    double min_ns = 0;
+    double max_ns = 0;
+    double items_per_iteration = 1;
+    std::string item_unit = "op";
+};
+
+// Runs the benchmarks with access to the downloader's internal stages
+class DownloaderBenchmark {
+private:
+    StreetViewDownloader downloader;
+    bool quick;
+    std::string filter;
+    std::vector<BenchmarkResult> results;
+    std::mt19937 rng;
+
+    bool selected(const std::string& name) const {
+        return filter.empty() || name.find(filter) != std::string::npos;
+    }
+
+    // Time fn over a number of iterations after one warm-up call
+    template<class F>
+    void measure(const std::string& name, int iterations, double items, const std::string& unit, F&& fn) {
+        if (!selected(name)) {
+            return;
+        }
+        if (quick) {
+            iterations = std::max(1, iterations / 10);
+        }
+
+        fn();
+
+        BenchmarkResult result;
+        result.name = name;
+        result.iterations = iterations;
+        result.items_per_iteration = items;
+        result.item_unit = unit;
+        result.min_ns = std::numeric_limits<double>::max();
+
+        double total_ns = 0;
+        for (int i = 0; i < iterations; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+            total_ns += elapsed;
+            result.min_ns = std::min(result.min_ns, elapsed);
+            result.max_ns = std::max(result.max_ns, elapsed);
+        }
+        result.mean_ns = total_ns / iterations;
+        results.push_back(result);
+
+        std::cerr << name << ": " << std::fixed << std::setprecision(3) << result.mean_ns / 1e6 << " ms" << std::endl;
+    }
+
+    // Smooth gradient with noise, so JPEG sizes resemble real imagery rather than flat color
+    cv::Mat synthetic_image(int width, int height) {
+        cv::Mat image(height, width, CV_8UC3);
+        std::uniform_int_distribution<int> noise(0, 24);
+        for (int y = 0; y < height; ++y) {
+            uchar* row = image.ptr<uchar>(y);
+            for (int x = 0; x < width; ++x) {
+                row[x * 3] = static_cast<uchar>((x * 255 / width + noise(rng)) & 0xFF);
+                row[x * 3 + 1] = static_cast<uchar>((y * 255 / height + noise(rng)) & 0xFF);
+                row[x * 3 + 2] = static_cast<uchar>(((x + y) * 127 / (width + height) + noise(rng)) & 0xFF);
+            }
+        }
+        return image;
+    }
+
+    static std::string encode_jpeg(const cv::Mat& image, int quality) {
+        std::vector<uchar> buffer;
+        cv::imencode(".jpg", image, buffer, { cv::IMWRITE_JPEG_QUALITY, quality });
+        return std::string(buffer.begin(), buffer.end());
+    }
+
+    void bench_tiles() {
+        cv::Mat tile_image = synthetic_image(512, 512);
+        std::string tile = encode_jpeg(tile_image, 90);
+        std::string blank = encode_jpeg(cv::Mat(512, 512, CV_8UC3, cv::Scalar(0, 0, 0)), 90);
+        const int batch = 64;
+
+        measure("is_valid_tile/content", 200, batch, "tile", [&]() {
+            for (int i = 0; i < batch; ++i) {
+                volatile bool valid = downloader.is_valid_tile(tile);
+                (void)valid;
+            }
+            });
+        measure("is_valid_tile/blank", 200, batch, "tile", [&]() {
+            for (int i = 0; i < batch; ++i) {
+                volatile bool valid = downloader.is_valid_tile(blank);
+                (void)valid;
+            }
+            });
+        measure("tile_decode", 200, 1, "tile", [&]() {
+            if (downloader.decode_tile(tile).empty()) {
+                throw std::runtime_error("Tile decode benchmark produced an empty image");
+            }
+            });
+    }
+
+    void bench_stitch_and_project() {
+        // Generation 4 layout: 16 x 8 tiles of 512 px; quick runs use a quarter of it
+        int max_x = quick ? 8 : 16;
+        int max_y = quick ? 4 : 8;
+        cv::Mat tile_image = synthetic_image(512, 512);
+        std::map<std::pair<int, int>, cv::Mat> tiles;
+        for (int x = 0; x < max_x; ++x) {
+            for (int y = 0; y < max_y; ++y) {
+                tiles[{ x, y }] = tile_image.clone();
+            }
+        }
+
+#ifdef USE_TBB
+        const std::string stitch_name = "stitch_panorama/tbb";
+#else
+        const std::string stitch_name = "stitch_panorama/sequential";
+#endif
+        cv::Mat panorama;
+        measure(stitch_name, 20, static_cast<double>(max_x * max_y), "tile", [&]() {
+            panorama = downloader.stitch_panorama(tiles, max_x, max_y, 5);
+            });
+
+        if (panorama.empty()) {
+            panorama = downloader.stitch_panorama(tiles, max_x, max_y, 5);
+        }
+        const ViewConfig& views = downloader.view_config;
+        measure("equirect_to_rectilinear", 50, 1, "view", [&]() {
+            downloader.equirect_to_rectilinear(panorama, 0.7, views.vfov_deg * M_PI / 180.0,
+                views.output_size, views.pitch_deg * M_PI / 180.0, 0.0, views.hfov_deg * M_PI / 180.0);
+            });
+
+        cv::Mat view = downloader.equirect_to_rectilinear(panorama, 0.7, views.vfov_deg * M_PI / 180.0,
+            views.output_size, 0.0, 0.0, views.hfov_deg * M_PI / 180.0);
+        std::vector<int> params = { cv::IMWRITE_JPEG_QUALITY, downloader.jpeg_quality };
+        measure("view_encode", 50, 1, "view", [&]() {
+            std::vector<uchar> buffer;
+            cv::imencode(".jpg", view, buffer, params);
+            });
+    }
+
+    // Quoting must not merge rows: a stray quote inside an unquoted field is plain text, while
+    // a quoted field may span lines
+    void check_csv_quoting() {
+        fs::path path = fs::temp_directory_path() / "streetview_bench_quotes.csv";
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file << "panoid,description,heading\n"
+                "PANO_A,plain,1\n"
+                "PANO_B,5\" pole,2\n"
+                "PANO_C, \"quoted, with \"\"escapes\"\"\nand a line break\",3\n"
+                "PANO_D,x,4\n";
+        }
+
+        std::vector<std::string> parsed;
+        {
+            CSVHandler handler(path.string());
+            std::string panoid;
+            while (handler.next_panoid(panoid)) {
+                parsed.push_back(panoid);
+            }
+        }
+        std::error_code ec;
+        fs::remove(path, ec);
+
+        const std::vector<std::string> expected = { "PANO_A", "PANO_B", "PANO_C", "PANO_D" };
+        if (parsed != expected) {
+            std::string got;
+            for (const std::string& panoid : parsed) {
+                got += (got.empty() ? "" : " ") + panoid;
+            }
+            throw std::runtime_error("CSV quoting check failed, parsed: " + got);
+        }
+    }
+
+    void bench_csv() {
+        if (selected("csv_parse")) {
+            check_csv_quoting();
+        }
+
+        const int rows = quick ? 100000 : 1000000;
+        fs::path path = fs::temp_directory_path() / "streetview_bench.csv";
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file << "panoid,lat,lon,date,heading\n";
+            const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+            std::uniform_int_distribution<int> pick(0, 63);
+            for (int i = 0; i < rows; ++i) {
+                std::string panoid(22, 'A');
+                for (char& c : panoid) {
+                    c = alphabet[pick(rng)];
+                }
+                file << panoid << ",52." << i % 100000 << ",13." << i % 7919 << ",\"2019-07\"," << i % 360 << "\n";
+            }
+        }
+
+        measure("csv_parse", 5, rows, "row", [&]() {
+            CSVHandler handler(path.string());
+            std::string panoid;
+            size_t count = 0;
+            while (handler.next_panoid(panoid)) {
+                count++;
+            }
+            if (count == 0) {
+                throw std::runtime_error("CSV benchmark parsed no rows");
+            }
+            });
+
+        std::error_code ec;
+        fs::remove(path, ec);
+    }
+
+    void bench_thread_pool() {
+        const int tasks = quick ? 10000 : 100000;
+        size_t threads = std::max(2u, std::thread::hardware_concurrency());
+        ThreadPool pool(threads);
+
+        measure("thread_pool/enqueue_wait", 5, tasks, "task", [&]() {
+            std::vector<std::future<int>> futures;
+            futures.reserve(tasks);
+            for (int i = 0; i < tasks; ++i) {
+                futures.push_back(pool.enqueue([i]() { return i; }));
+            }
+            for (auto& future : futures) {
+                pool.wait(future);
+            }
+            });
+
+        measure("thread_pool/post", 5, tasks, "task", [&]() {
+            std::atomic<int> done(0);
+            for (int i = 0; i < tasks; ++i) {
+                pool.post([&done]() { done++; });
+            }
+            while (done < tasks) {
+                std::this_thread::yield();
+            }
+            });
+    }
+
+public:
+    DownloaderBenchmark(bool quick_run, std::string name_filter) :
+        quick(quick_run), filter(std::move(name_filter)), rng(12345) {
+        // Keep the log quiet; only the JSON report matters here
+        downloader.logger->set_level(LogLevel::error);
+    }
+
+    // Write distinct content tiles plus one blank tile for the mock tile server
+    void write_fixtures(const std::string& directory, int count) {
+        fs::create_directories(directory);
+        for (int i = 0; i < count; ++i) {
+            std::ofstream file(fs::path(directory) / ("tile_" + std::to_string(i) + ".jpg"), std::ios::binary);
+            file << encode_jpeg(synthetic_image(512, 512), 90);
+        }
+        std::ofstream blank(fs::path(directory) / "blank.jpg", std::ios::binary);
+        blank << encode_jpeg(cv::Mat(512, 512, CV_8UC3, cv::Scalar(0, 0, 0)), 90);
+    }
+
+    void run_all() {
+        bench_tiles();
+        bench_stitch_and_project();
+        bench_csv();
+        bench_thread_pool();
+    }
+
+    std::string to_json() const {
+        std::ostringstream out;
+        out << std::setprecision(6) << std::fixed;
+        out << "{\n  \"context\": {\n";
+        out << "    \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef USE_TBB
+        out << "    \"tbb\": true,\n";
+#else
+        out << "    \"tbb\": false,\n";
+#endif
+#ifdef HAVE_AVX2
+        out << "    \"simd\": \"avx2\",\n";
+#elif defined(HAVE_SSE2)
+        out << "    \"simd\": \"sse2\",\n";
+#else
+        out << "    \"simd\": \"none\",\n";
+#endif
+        out << "    \"quick\": " << (quick ? "true" : "false") << "\n  },\n";
+        out << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const BenchmarkResult& r = results[i];
+            double per_second = r.items_per_iteration * 1e9 / r.mean_ns;
+            out << "    {\"name\": \"" << r.name << "\", \"iterations\": " << r.iterations
+                << ", \"mean_ns\": " << r.mean_ns << ", \"min_ns\": " << r.min_ns << ", \"max_ns\": " << r.max_ns
+                << ", \"items_per_second\": " << per_second << ", \"item\": \"" << r.item_unit << "\"}"
+                << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "  ]\n}\n";
+        return out.str();
+    }
+};
+
+int main(int argc, char* argv[]) {
+    bool quick = false;
+    std::string filter;
+    std::string output_path;
+    std::string fixtures_path;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        }
+        else if (arg == "--output" && i + 1 < argc) {
+            output_path = argv[++i];
+        }
+        else if (arg == "--write-fixtures" && i + 1 < argc) {
+            fixtures_path = argv[++i];
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--quick] [--filter NAME] [--output FILE]" << std::endl;
+            std::cerr << "   or: " << argv[0] << " --write-fixtures DIR" << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        DownloaderBenchmark benchmark(quick, filter);
+        if (!fixtures_path.empty()) {
+            benchmark.write_fixtures(fixtures_path, 16);
+            std::cerr << "Wrote fixture tiles to " << fixtures_path << std::endl;
+            return 0;
+        }
+        benchmark.run_all();
+
+        std::string json = benchmark.to_json();
+        if (output_path.empty()) {
+            std::cout << json;
+        }
+        else {
+            std::ofstream file(output_path, std::ios::binary | std::ios::trunc);
+            file << json;
+        }
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+// Public interface of the streetview library: fetch panoramas and render their views in memory.
+// The streetview_downloader command line tool is built from the same library.
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Structured reason a panorama failed, reported in the results stream
+enum class FailureCode {
+    none,
+    detection_failed,       // No generation probe returned a usable tile
+    all_tiles_blank,        // Every tile was a blank placeholder
+    http_error,             // Tiles failed with an HTTP status (see http_status)
+    network_error,          // Tiles failed at the transport level
+    timeout,                // --panorama-timeout expired
+    too_many_failed_tiles,  // --max-failed-tiles reached
+    stitch_failed,
+    load_failed,            // A stored panorama could not be read (--reproject)
+    write_failed,           // Views could not be encoded or written
+    error                   // Unexpected exception
+};
+
+inline const char* failure_code_name(FailureCode code) {
+    switch (code) {
+    case FailureCode::none: return "none";
+    case FailureCode::detection_failed: return "detection_failed";
+    case FailureCode::all_tiles_blank: return "all_tiles_blank";
+    case FailureCode::http_error: return "http_error";
+    case FailureCode::network_error: return "network_error";
+    case FailureCode::timeout: return "timeout";
+    case FailureCode::too_many_failed_tiles: return "too_many_failed_tiles";
+    case FailureCode::stitch_failed: return "stitch_failed";
+    case FailureCode::load_failed: return "load_failed";
+    case FailureCode::write_failed: return "write_failed";
+    case FailureCode::error: return "error";
+    }
+    return "error";
+}
+
+// Settings of a library client; the defaults match the command line tool
+struct StreetViewOptions {
+    std::string tile_host = "https://streetviewpixels-pa.googleapis.com";
+    int tile_threads = 128;
+    int pano_threads = 4;             // Panoramas in flight during process_batch
+    int max_threads = 512;
+    int timeout_seconds = 10;         // Per tile request
+    int retries = 3;
+    double panorama_timeout = 0;      // Seconds; 0 = off
+    int max_failed_tiles = 0;         // 0 = off
+    bool auto_crop = true;
+
+    // Views cut from each panorama
+    int view_size = 512;
+    int num_views = 8;
+    double hfov_deg = 90.0;
+    double vfov_deg = 90.0;
+    double pitch_deg = 5.0;
+    double yaw_deg = 5.0;
+    double rotation_jitter_deg = 22.5;
+    double fov_jitter_deg = 5.0;
+    bool deterministic_seed = false;  // Seed jitter per PanoID from seed
+    uint64_t seed = 0;
+
+    // Hedged requests and circuit breaker; zero disables either
+    double hedge_percentile = 0;
+    double hedge_budget = 5;
+    double breaker_threshold = 0.5;
+    double breaker_window = 10;
+    double breaker_cooldown = 5;
+
+    // Library clients log nowhere unless given a file
+    std::string log_file;
+};
+
+// One rectilinear view, as a BGR image
+struct StreetViewView {
+    int index = 0;                    // 1-based, clockwise from north
+    std::string direction;            // "N", "NE", ... or "H045" for other view counts
+    double heading_deg = 0;           // Heading after rotation jitter
+    cv::Mat image;
+};
+
+// Outcome of one panorama; images are empty when not requested or on failure
+struct StreetViewPanorama {
+    std::string panoid;
+    bool success = false;
+    FailureCode failure = FailureCode::none;
+    bool retryable = false;
+    std::string message;
+    int http_status = 0;
+    int generation = 0;
+    double total_ms = 0;
+    cv::Mat panorama;                 // Stitched equirectangular panorama
+    std::vector<StreetViewView> views;
+};
+
+struct StreetViewBatchSummary {
+    int successful = 0;
+    int failed = 0;
+};
+
+class StreetViewDownloader;
+
+// Asynchronous in-memory client. Calls may be issued from any thread and run on a shared
+// pool; nothing is encoded or written to disk.
+class StreetViewClient {
+public:
+    // Called once per finished panorama, from worker threads and possibly concurrently
+    using ResultCallback = std::function<void(StreetViewPanorama&&)>;
+
+    explicit StreetViewClient(const StreetViewOptions& options = StreetViewOptions());
+    ~StreetViewClient();
+
+    StreetViewClient(const StreetViewClient&) = delete;
+    StreetViewClient& operator=(const StreetViewClient&) = delete;
+
+    // Download and stitch one panorama, optionally rendering its views as well
+    std::future<StreetViewPanorama> fetch_panorama(const std::string& panoid, bool with_views = false);
+
+    // Render views from a panorama already in memory; with a seed, the PanoID seeds the jitter
+    std::future<std::vector<StreetViewView>> render_views(cv::Mat panorama, const std::string& panoid);
+
+    // Fetch a batch with a bounded number of panoramas in flight, delivering views through
+    // on_result as each panorama finishes. Batches run one at a time.
+    std::future<StreetViewBatchSummary> process_batch(std::vector<std::string> panoids,
+        ResultCallback on_result, bool keep_panorama = false);
+
+private:
+    std::unique_ptr<StreetViewDownloader> downloader;
+    std::mutex batch_mutex;
+
+    // Calls still running; the destructor waits for them before tearing the pipeline down
+    std::mutex pending_mutex;
+    std::condition_variable pending_done;
+    int pending = 0;
+
+    void begin_call();
+    void end_call();
+
+    template<class F>
+    auto submit(F&& f) -> std::future<decltype(f())>;
+};
@@ -0,0 +1,18 @@
+// Command line front end of the streetview library
+
+#include <iostream>
+#include <exception>
+
+// Parses the arguments, processes the input and writes views to disk; defined in
+// streetview_downloader.cpp alongside the pipeline it drives
+int run_downloader_cli(int argc, char* argv[]);
+
+int main(int argc, char* argv[]) {
+    try {
+        return run_downloader_cli(argc, argv);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Fatal error: " << e.what() << std::endl;
+        return 1;
+    }
+}
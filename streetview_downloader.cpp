@@ -8,6 +8,7 @@
 #include <map>
 #include <unordered_map>
 #include <queue>
+#include <deque>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -23,12 +24,21 @@
 #include <functional>
 #include <iomanip>
 #include <cstring>
+#include <unordered_set>
+#include <shared_mutex>
+#include <cstdint>
+#include <cstddef>
+#include <array>
 #include "fixerrors.h"
+#include "streetview.h"
 
 #ifdef _WIN32
 #include <windows.h>
+#include <io.h>
 #else
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <termios.h>
 #endif
@@ -37,6 +47,25 @@
 #include <curl/curl.h>
 #include <opencv2/opencv.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HAVE_SSE2
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define HAVE_AVX2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef USE_IO_URING
+#include <liburing.h>
+#include <cerrno>
+#endif
+
 #ifdef _WIN32
 #include <direct.h>
 #define MKDIR(dir) _mkdir(dir)
@@ -56,64 +85,713 @@
 
 namespace fs = std::filesystem;
 
-// Thread-safe logging class
+// Hint to the CPU that we are spinning on a shared value
+inline void cpu_relax() {
+#ifdef HAVE_SSE2
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// Bounded lock-free multi-producer multi-consumer ring (Vyukov). Each cell carries a
+// sequence number that tells producers and consumers whether it is free or filled.
+template<typename T>
+class MPMCQueue {
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_pos;
+    alignas(64) std::atomic<size_t> dequeue_pos;
+
+public:
+    explicit MPMCQueue(size_t capacity) : enqueue_pos(0), dequeue_pos(0) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Moves from value only when the push succeeds
+    bool try_push(T& value) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.data = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;   // Full
+            }
+            else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = std::move(cell.data);
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) {
+                return false;   // Empty
+            }
+            else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// Bounded lock-free work-stealing deque (Chase-Lev). The owning worker pushes and pops at the
+// bottom, newest first; other workers steal from the top, oldest first. A slot is written again
+// only after whoever took its task has moved it out.
+template<typename T>
+class WorkStealingDeque {
+private:
+    struct Slot {
+        std::atomic<bool> full{ false };
+        T data;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    int64_t capacity;
+    int64_t mask;
+    alignas(64) std::atomic<int64_t> top;
+    alignas(64) std::atomic<int64_t> bottom;
+
+    void take(int64_t index, T& value) {
+        Slot& slot = slots[index & mask];
+        value = std::move(slot.data);
+        slot.full.store(false, std::memory_order_release);
+    }
+
+public:
+    explicit WorkStealingDeque(size_t min_capacity) : top(0), bottom(0) {
+        size_t size = 2;
+        while (size < min_capacity) {
+            size <<= 1;
+        }
+        slots.reset(new Slot[size]);
+        capacity = static_cast<int64_t>(size);
+        mask = capacity - 1;
+    }
+
+    // Owner only; moves from value only when the push succeeds
+    bool try_push(T& value) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Slot& slot = slots[b & mask];
+        if (b - t >= capacity || slot.full.load(std::memory_order_acquire)) {
+            return false;   // Full, or a thief is still moving the previous task out
+        }
+        slot.data = std::move(value);
+        slot.full.store(true, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Owner only; newest task first
+    bool try_pop(T& value) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_release);
+            return false;
+        }
+        if (t == b) {
+            // Last task: race the thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_release);
+            if (!won) {
+                return false;
+            }
+        }
+        take(b, value);
+        return true;
+    }
+
+    // Any thread; oldest task first
+    bool try_steal(T& value) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b || !top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        take(t, value);
+        return true;
+    }
+
+    bool empty() const {
+        return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed);
+    }
+};
+
+// Severity of a log message
+enum class LogLevel : uint8_t {
+    debug,
+    info,
+    warning,
+    error
+};
+
+// Messages below this level are compiled out of Logger::enabled() checks
+#ifndef STREETVIEW_MIN_LOG_LEVEL
+#define STREETVIEW_MIN_LOG_LEVEL 0
+#endif
+
+// Asynchronous logger. Callers push records into a lock-free ring and return immediately;
+// a background thread formats them and writes whole batches, flushing once per batch.
 class Logger {
 private:
-    std::mutex log_mutex;
+    struct Record {
+        LogLevel level = LogLevel::info;
+        std::chrono::system_clock::time_point time;
+        std::string message;
+    };
+
+    static constexpr size_t ring_capacity = 8192;
+    static constexpr std::chrono::milliseconds idle_interval{ 50 };
+
+    MPMCQueue<Record> ring;
     std::ofstream log_file;
     bool console_output;
+    std::atomic<int> min_level;
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> written;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::atomic<bool> wake_requested;
+    bool stop;
+    std::thread writer;
+
+    static const char* level_name(LogLevel level) {
+        switch (level) {
+        case LogLevel::debug: return "DEBUG";
+        case LogLevel::info: return "INFO";
+        case LogLevel::warning: return "WARNING";
+        default: return "ERROR";
+        }
+    }
+
+    void request_wake() {
+        if (!wake_requested.exchange(true)) {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            wake.notify_one();
+        }
+    }
+
+    void writer_loop() {
+        std::string batch;
+        Record record;
+        std::time_t stamp_second = -1;
+        char stamp[32] = "";
+
+        while (true) {
+            uint64_t count = 0;
+            while (ring.try_pop(record)) {
+                // Timestamps only change once a second, so format them once a second
+                std::time_t second = std::chrono::system_clock::to_time_t(record.time);
+                if (second != stamp_second) {
+                    std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", std::localtime(&second));
+                    stamp_second = second;
+                }
+                batch += stamp;
+                batch += " - ";
+                batch += level_name(record.level);
+                batch += " - ";
+                batch += record.message;
+                batch += '\n';
+                count++;
+            }
+
+            if (count > 0) {
+                if (log_file.is_open()) {
+                    log_file.write(batch.data(), batch.size());
+                    log_file.flush();
+                }
+                if (console_output) {
+                    std::cout.write(batch.data(), batch.size());
+                    std::cout.flush();
+                }
+                batch.clear();
+                written += count;
+            }
+
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            drained.notify_all();
+            if (stop && written == submitted) {
+                return;
+            }
+            if (count == 0) {
+                wake.wait_for(lock, idle_interval, [this] { return stop || wake_requested.load(); });
+                wake_requested = false;
+            }
+        }
+    }
 
 public:
-    Logger(const std::string& filename, bool console = true) : console_output(console) {
+    Logger(const std::string& filename, bool console = true) :
+        ring(ring_capacity), console_output(console), min_level(static_cast<int>(LogLevel::info)),
+        submitted(0), written(0), wake_requested(false), stop(false) {
         log_file.open(filename, std::ios::app);
+        writer = std::thread([this] { writer_loop(); });
     }
 
     ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex);
+            stop = true;
+        }
+        wake.notify_one();
+        writer.join();
         if (log_file.is_open()) {
             log_file.close();
         }
     }
 
-    void log(const std::string& message) {
-        std::lock_guard<std::mutex> lock(log_mutex);
+    // Cheap check callers can use to skip building messages that would be dropped
+    bool enabled(LogLevel level) const {
+#if STREETVIEW_MIN_LOG_LEVEL > 0
+        if (static_cast<int>(level) < STREETVIEW_MIN_LOG_LEVEL) {
+            return false;
+        }
+#endif
+        return static_cast<int>(level) >= min_level.load(std::memory_order_relaxed);
+    }
+
+    void set_level(LogLevel level) { min_level = static_cast<int>(level); }
+
+    void log(LogLevel level, std::string message) {
+        if (!enabled(level)) {
+            return;
+        }
+
+        Record record;
+        record.level = level;
+        record.time = std::chrono::system_clock::now();
+        record.message = std::move(message);
+
+        uint64_t backlog = ++submitted - written;
+        while (!ring.try_push(record)) {
+            // Ring full: let the writer catch up rather than drop the message
+            request_wake();
+            std::this_thread::yield();
+        }
+
+        // The writer polls on its own; only wake it early once a backlog builds up
+        if (backlog >= ring_capacity / 2) {
+            request_wake();
+        }
+    }
+
+    void log(const std::string& message) { log(LogLevel::info, message); }
 
-        // Get current time
-        auto now = std::chrono::system_clock::now();
-        auto time_t_now = std::chrono::system_clock::to_time_t(now);
+    // Block until everything logged so far has been written out
+    void flush() {
+        uint64_t target = submitted;
+        std::unique_lock<std::mutex> lock(wake_mutex);
+        wake_requested = true;
+        wake.notify_one();
+        drained.wait(lock, [this, target] { return written >= target; });
+    }
+};
 
-        std::stringstream timestamp;
-        timestamp << std::put_time(std::localtime(&time_t_now), "%Y-%m-%d %H:%M:%S");
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    const char* data_;
+    size_t size_;
+#ifdef _WIN32
+    HANDLE file_handle;
+    HANDLE mapping_handle;
+#else
+    int fd;
+#endif
 
-        std::string formatted_message = timestamp.str() + " - INFO - " + message;
+public:
+    MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+#ifdef _WIN32
+        mapping_handle = nullptr;
+        file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_handle == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Could not open file: " + path);
+        }
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(file_handle, &file_size);
+        size_ = static_cast<size_t>(file_size.QuadPart);
+        if (size_ > 0) {
+            mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_handle) {
+                data_ = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+            }
+            if (!data_) {
+                if (mapping_handle) CloseHandle(mapping_handle);
+                CloseHandle(file_handle);
+                throw std::runtime_error("Could not map file: " + path);
+            }
+        }
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file: " + path);
+        }
+        struct stat file_stat;
+        fstat(fd, &file_stat);
+        size_ = static_cast<size_t>(file_stat.st_size);
+        if (size_ > 0) {
+            void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Could not map file: " + path);
+            }
+            // Rows are parsed front to back, so let the kernel read ahead aggressively
+            madvise(mapping, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(mapping);
+        }
+#endif
+    }
 
-        // Write to file
-        if (log_file.is_open()) {
-            log_file << formatted_message << std::endl;
+    ~MappedFile() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_handle) CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+#else
+        if (data_) munmap(const_cast<char*>(data_), size_);
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+};
+
+// FNV-1a hash used for payload fingerprints, per-PanoID seeds and deduplication
+inline uint64_t fnv1a_hash(const std::string& data) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : data) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Open-addressing map from 64-bit hashes to 64-bit values, 16 bytes per slot.
+// Only hashes of the keys are stored, so millions of entries stay compact; the caller keeps
+// the key bytes and tells a real match from a hash collision by comparing them.
+class CompactHashMap {
+private:
+    struct Slot {
+        uint64_t key;    // 0 marks an empty slot
+        uint64_t value;
+    };
+
+    std::vector<Slot> slots;
+    size_t count;
+
+    void grow() {
+        std::vector<Slot> old_slots(slots.empty() ? 1024 : slots.size() * 2);
+        old_slots.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (const Slot& slot : old_slots) {
+            if (slot.key != 0) {
+                size_t i = slot.key & mask;
+                while (slots[i].key != 0) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = slot;
+            }
+        }
+    }
+
+public:
+    CompactHashMap() : count(0) {}
+
+    // Insert the key with the given hash if absent; otherwise leave the map unchanged and
+    // report the stored value. same_key(value) compares the key stored under value with the
+    // new one, so distinct keys sharing a hash are both kept.
+    template<typename SameKey>
+    bool insert(uint64_t hash, uint64_t value, uint64_t& existing, SameKey&& same_key) {
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+        hash = hash ? hash : 1;
+
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            if (slots[i].key == 0) {
+                slots[i] = { hash, value };
+                count++;
+                return true;
+            }
+            if (slots[i].key == hash && same_key(slots[i].value)) {
+                existing = slots[i].value;
+                return false;
+            }
+        }
+    }
+
+    size_t size() const { return count; }
+};
+
+// Vectorized CSV tokenizer with RFC 4180 quoting
+class CSVTokenizer {
+private:
+    static bool is_space(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    static int lowest_bit(unsigned int mask) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+public:
+    // Find the first of two structural characters, scanning 32 or 16 bytes at a time
+    static const char* find_either(const char* p, const char* end, char a, char b) {
+#ifdef HAVE_AVX2
+        const __m256i wide_a = _mm256_set1_epi8(a);
+        const __m256i wide_b = _mm256_set1_epi8(b);
+        for (; p + 32 <= end; p += 32) {
+            __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, wide_a), _mm256_cmpeq_epi8(chunk, wide_b))));
+            if (mask) {
+                return p + lowest_bit(mask);
+            }
+        }
+#endif
+#ifdef HAVE_SSE2
+        const __m128i vec_a = _mm_set1_epi8(a);
+        const __m128i vec_b = _mm_set1_epi8(b);
+        for (; p + 16 <= end; p += 16) {
+            __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            unsigned int mask = static_cast<unsigned int>(_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, vec_a), _mm_cmpeq_epi8(chunk, vec_b))));
+            if (mask) {
+                return p + lowest_bit(mask);
+            }
+        }
+#endif
+        for (; p < end; ++p) {
+            if (*p == a || *p == b) {
+                return p;
+            }
+        }
+        return end;
+    }
+
+    // Single characters go through memchr, which the C library already vectorizes
+    static const char* find_char(const char* p, const char* end, char c) {
+        const void* found = std::memchr(p, c, end - p);
+        return found ? static_cast<const char*>(found) : end;
+    }
+
+    // End of the record starting at p: the first newline outside quotes, or end. As in
+    // next_field, a quote only opens a quoted field when it is the first non-space character
+    // of the field; a stray quote inside an unquoted field is plain text.
+    static const char* record_end(const char* p, const char* end, char delimiter) {
+        const char* begin = p;
+        bool in_quotes = false;
+        while (p < end) {
+            p = in_quotes ? find_char(p, end, '"') : find_either(p, end, '\n', '"');
+            if (p == end || (!in_quotes && *p == '\n')) {
+                return p;
+            }
+            if (in_quotes) {
+                // A doubled quote inside a quoted field is an escaped quote and does not close it
+                if (p + 1 < end && p[1] == '"') {
+                    p += 2;
+                    continue;
+                }
+                in_quotes = false;
+            }
+            else {
+                const char* field_start = p;
+                while (field_start > begin && field_start[-1] != delimiter && is_space(field_start[-1])) {
+                    --field_start;
+                }
+                in_quotes = field_start == begin || field_start[-1] == delimiter;
+            }
+            ++p;
+        }
+        return end;
+    }
+
+    // Parse the field starting at p within one record into field (unquoted and trimmed).
+    // Returns the position of the delimiter that ends it, or end.
+    static const char* next_field(const char* p, const char* end, char delimiter, std::string& field) {
+        field.clear();
+        while (p < end && *p != delimiter && is_space(*p)) {
+            ++p;
+        }
+
+        if (p < end && *p == '"') {
+            ++p;
+            while (p < end) {
+                const char* quote = find_char(p, end, '"');
+                field.append(p, quote);
+                if (quote + 1 < end && quote[1] == '"') {
+                    field.push_back('"');
+                    p = quote + 2;
+                    continue;
+                }
+                p = quote == end ? end : quote + 1;
+                break;
+            }
+            // Anything between the closing quote and the delimiter is kept, minus whitespace
+            const char* stop = find_char(p, end, delimiter);
+            while (p < stop && is_space(*p)) {
+                ++p;
+            }
+            const char* tail_end = stop;
+            while (tail_end > p && is_space(*(tail_end - 1))) {
+                --tail_end;
+            }
+            field.append(p, tail_end);
+            return stop;
+        }
+
+        const char* stop = find_char(p, end, delimiter);
+        const char* value_end = stop;
+        while (value_end > p && is_space(*(value_end - 1))) {
+            --value_end;
+        }
+        field.assign(p, value_end);
+        return stop;
+    }
+
+    // Split a whole record into fields
+    static void split(const char* p, const char* end, char delimiter, std::vector<std::string>& fields) {
+        fields.clear();
+        if (p == end) {
+            return;
+        }
+        std::string field;
+        while (true) {
+            p = next_field(p, end, delimiter, field);
+            fields.push_back(field);
+            if (p == end) {
+                break;
+            }
+            ++p;
         }
+    }
 
-        // Output to console if enabled
-        if (console_output) {
-            std::cout << formatted_message << std::endl;
+    // Extract only the field at index; returns false if the record is shorter
+    static bool field_at(const char* p, const char* end, char delimiter, int index, std::string& field) {
+        for (int i = 0; ; ++i) {
+            p = next_field(p, end, delimiter, field);
+            if (i == index) {
+                return true;
+            }
+            if (p == end) {
+                return false;
+            }
+            ++p;
         }
     }
 };
 
 // CSV handling class for different CSV formats
+// Rows are parsed on demand from a memory-mapped file; only their byte ranges are kept
 class CSVHandler {
 private:
+    // Whether a row belongs in the cleaned output; pending until its PanoID has finished
+    enum RowState : uint8_t {
+        row_pending,
+        row_kept,
+        row_dropped,
+        row_duplicate   // Follows the outcome of an earlier row with the same PanoID
+    };
+
+    // Location of a data row inside the mapped file
+    struct RowSpan {
+        uint64_t offset;
+        uint64_t length;    // An unterminated quoted field can span most of the file
+        RowState state;
+    };
+
+    static constexpr size_t cleaned_buffer_size = 4 * 1024 * 1024;
+
     char delimiter;
     std::string file_path;
+    std::unique_ptr<MappedFile> mapped_file;
     std::vector<std::string> headers;
-    std::vector<std::vector<std::string>> rows;
+    RowSpan header_span;
+    std::vector<RowSpan> rows;
+    std::vector<size_t> item_rows;  // Row index of each PanoID handed out by next_panoid
+    CompactHashMap seen_panoids;    // PanoID hash -> index of the item that first carried it
+    std::unordered_map<size_t, size_t> duplicate_rows;  // Duplicate row -> original item
+    size_t cursor;
     bool has_headers;
     int panoid_column_index;
 
+    // Incremental cleaned CSV output
+    std::ofstream cleaned_file;
+    std::vector<char> cleaned_buffer;
+    size_t cleaned_cursor;
+
+    void append_row_bytes(const RowSpan& row) {
+        const char* begin = mapped_file->data() + row.offset;
+        cleaned_buffer.insert(cleaned_buffer.end(), begin, begin + row.length);
+        cleaned_buffer.push_back('\n');
+        if (cleaned_buffer.size() >= cleaned_buffer_size) {
+            cleaned_file.write(cleaned_buffer.data(), cleaned_buffer.size());
+            cleaned_buffer.clear();
+        }
+    }
+
     // Detect the delimiter used in a CSV file
     char detect_delimiter(const std::string& sample_line) {
-        // Count occurrence of common delimiters
-        int comma_count = std::count(sample_line.begin(), sample_line.end(), ',');
-        int semicolon_count = std::count(sample_line.begin(), sample_line.end(), ';');
-        int tab_count = std::count(sample_line.begin(), sample_line.end(), '\t');
+        // Count occurrence of common delimiters in a single pass
+        int comma_count = 0;
+        int semicolon_count = 0;
+        int tab_count = 0;
+        for (char c : sample_line) {
+            comma_count += c == ',';
+            semicolon_count += c == ';';
+            tab_count += c == '\t';
+        }
 
         // Return the most common delimiter
         if (semicolon_count > comma_count && semicolon_count > tab_count) {
@@ -127,20 +805,27 @@ private:
         }
     }
 
-    // Split a line by the delimiter
+    // Split a line by the delimiter, honouring quoted fields
     std::vector<std::string> split_line(const std::string& line) {
         std::vector<std::string> result;
-        std::stringstream ss(line);
-        std::string item;
+        CSVTokenizer::split(line.data(), line.data() + line.size(), delimiter, result);
+        return result;
+    }
 
-        while (std::getline(ss, item, delimiter)) {
-            // Trim whitespace
-            item.erase(0, item.find_first_not_of(" \t\r\n"));
-            item.erase(item.find_last_not_of(" \t\r\n") + 1);
-            result.push_back(item);
-        }
+    // Find the end of the record starting at pos (a newline outside quotes)
+    size_t line_end(size_t pos) const {
+        const char* data = mapped_file->data();
+        return CSVTokenizer::record_end(data + pos, data + mapped_file->size(), delimiter) - data;
+    }
 
-        return result;
+    // Pull a single field out of a row without splitting the whole line
+    bool field_at(const RowSpan& row, int index, std::string& field) const {
+        const char* begin = mapped_file->data() + row.offset;
+        return CSVTokenizer::field_at(begin, begin + row.length, delimiter, index, field);
+    }
+
+    std::string row_text(const RowSpan& row) const {
+        return std::string(mapped_file->data() + row.offset, row.length);
     }
 
     // Determine the column index for PanoID
@@ -200,66 +885,135 @@ private:
         return str;
     }
 
+    // In-place variant of extract_panoid that avoids a copy per row
+    void truncate_to_panoid(std::string& str) const {
+        if (str.length() > 22 && !is_valid_panoid(str) &&
+            std::all_of(str.begin(), str.begin() + 22, [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+            })) {
+            str.resize(22);
+        }
+    }
+
 public:
-    CSVHandler(const std::string& path) : file_path(path), has_headers(true), panoid_column_index(0) {
+    CSVHandler(const std::string& path) :
+        delimiter(','), file_path(path), header_span{ 0, 0, row_kept }, cursor(0), has_headers(true),
+        panoid_column_index(0), cleaned_cursor(0) {
         load_csv();
     }
 
+    // Map the file and parse only the header; data rows are read by next_panoid
     void load_csv() {
-        std::ifstream file(file_path);
-        if (!file.is_open()) {
-            throw std::runtime_error("Could not open file: " + file_path);
+        mapped_file = std::make_unique<MappedFile>(file_path);
+        rows.clear();
+        item_rows.clear();
+        seen_panoids = CompactHashMap();
+        duplicate_rows.clear();
+        cursor = 0;
+
+        // Skip a UTF-8 byte order mark
+        if (mapped_file->size() >= 3 && std::memcmp(mapped_file->data(), "\xEF\xBB\xBF", 3) == 0) {
+            cursor = 3;
         }
 
-        // Read the first line to detect delimiter
-        std::string first_line;
-        if (std::getline(file, first_line)) {
-            delimiter = detect_delimiter(first_line);
+        // Read the first line to detect delimiter; the header record is then delimited with it
+        if (cursor < mapped_file->size()) {
+            const char* data = mapped_file->data();
+            const char* line = CSVTokenizer::find_char(data + cursor, data + mapped_file->size(), '\n');
+            delimiter = detect_delimiter(std::string(data + cursor, line));
+
+            size_t end = line_end(cursor);
+            std::string first_line(data + cursor, end - cursor);
+            header_span = { cursor, end - cursor, row_kept };
+            cursor = std::min(end + 1, mapped_file->size());
+
+            // Estimate the row count from the header length to avoid regrowing the span list
+            rows.reserve(mapped_file->size() / std::max<size_t>(first_line.size() + 1, 32));
 
             // Parse headers
             headers = split_line(first_line);
-
-            // Read data rows
-            std::string line;
-            while (std::getline(file, line)) {
-                if (!line.empty()) {
-                    rows.push_back(split_line(line));
-                }
-            }
         }
 
-        file.close();
-
         // Find PanoID column
         panoid_column_index = find_panoid_column();
     }
 
+    // PanoID of an item handed out earlier, parsed again from its row
+    std::string item_panoid(size_t item) {
+        std::string panoid;
+        field_at(rows[item_rows[item]], panoid_column_index, panoid);
+        truncate_to_panoid(panoid);
+        return panoid;
+    }
+
+    // Parse forward to the next row with a PanoID; returns false at end of file
+    bool next_panoid(std::string& panoid) {
+        while (cursor < mapped_file->size()) {
+            size_t end = line_end(cursor);
+            RowSpan row{ cursor, end - cursor, row_pending };
+            cursor = std::min(end + 1, mapped_file->size());
+
+            // Skip empty lines
+            if (row.length == 0 || (row.length == 1 && mapped_file->data()[row.offset] == '\r')) {
+                continue;
+            }
+
+            // Parse into the caller's string so its capacity is reused from row to row
+            if (!field_at(row, panoid_column_index, panoid)) {
+                // Rows too short to hold a PanoID never make it into the cleaned output
+                row.state = row_dropped;
+                rows.push_back(row);
+                continue;
+            }
+
+            // Extract just the PanoID part (not anything after semicolons)
+            truncate_to_panoid(panoid);
+            if (panoid.empty()) {
+                row.state = row_kept;
+                rows.push_back(row);
+                continue;
+            }
+
+            // Repeated PanoIDs are not handed out again; their rows mirror the first occurrence
+            uint64_t original_item;
+            if (!seen_panoids.insert(fnv1a_hash(panoid), item_rows.size(), original_item,
+                [this, &panoid](uint64_t item) { return item_panoid(item) == panoid; })) {
+                row.state = row_duplicate;
+                rows.push_back(row);
+                duplicate_rows[rows.size() - 1] = original_item;
+                continue;
+            }
+
+            rows.push_back(row);
+            item_rows.push_back(rows.size() - 1);
+            return true;
+        }
+
+        return false;
+    }
+
     // Get all PanoIDs from the CSV
     std::vector<std::string> get_panoids() {
         std::vector<std::string> panoids;
+        std::string panoid;
 
-        for (const auto& row : rows) {
-            if (row.size() > static_cast<size_t>(panoid_column_index)) {
-                // Extract just the PanoID part (not anything after semicolons)
-                std::string panoid = extract_panoid(row[panoid_column_index]);
-                if (!panoid.empty()) {
-                    panoids.push_back(panoid);
-                }
-            }
+        while (next_panoid(panoid)) {
+            panoids.push_back(panoid);
         }
 
         return panoids;
     }
 
-    // Get all rows with their PanoIDs
+    // Get all rows parsed so far with their PanoIDs
     std::map<std::string, std::vector<std::string>> get_rows_with_panoids() {
         std::map<std::string, std::vector<std::string>> result;
 
         for (const auto& row : rows) {
-            if (row.size() > static_cast<size_t>(panoid_column_index)) {
-                std::string panoid = extract_panoid(row[panoid_column_index]);
+            std::string field;
+            if (field_at(row, panoid_column_index, field)) {
+                std::string panoid = extract_panoid(field);
                 if (!panoid.empty()) {
-                    result[panoid] = row;
+                    result[panoid] = split_line(row_text(row));
                 }
             }
         }
@@ -267,52 +1021,66 @@ public:
         return result;
     }
 
-    // Write a new CSV without the specified failed PanoIDs
-    bool write_cleaned_csv(const std::set<std::string>& failed_panoids, const std::string& output_path) {
-        std::ofstream out_file(output_path);
-        if (!out_file.is_open()) {
-            return false;
+    // Record the outcome of the n-th PanoID handed out by next_panoid
+    void set_item_result(size_t item_index, bool failed) {
+        if (item_index < item_rows.size()) {
+            rows[item_rows[item_index]].state = failed ? row_dropped : row_kept;
         }
+    }
 
-        // Write headers
-        if (has_headers) {
-            for (size_t i = 0; i < headers.size(); i++) {
-                out_file << headers[i];
-                if (i < headers.size() - 1) {
-                    out_file << delimiter;
-                }
-            }
-            out_file << "\n";
+    // Start the cleaned CSV; rows are copied byte for byte from the input as results arrive
+    bool begin_cleaned_csv(const std::string& output_path) {
+        cleaned_file.open(output_path, std::ios::binary | std::ios::trunc);
+        if (!cleaned_file.is_open()) {
+            return false;
         }
+        cleaned_buffer.reserve(cleaned_buffer_size);
+        cleaned_cursor = 0;
 
-        // Write rows, excluding failed PanoIDs
-        for (const auto& row : rows) {
-            if (row.size() > static_cast<size_t>(panoid_column_index)) {
-                std::string raw_panoid = row[panoid_column_index];
-                std::string panoid = extract_panoid(raw_panoid);
-
-                if (failed_panoids.find(panoid) == failed_panoids.end()) {
-                    // This PanoID didn't fail, include it
-                    for (size_t i = 0; i < row.size(); i++) {
-                        out_file << row[i];
-                        if (i < row.size() - 1) {
-                            out_file << delimiter;
-                        }
-                    }
-                    out_file << "\n";
-                }
-            }
+        if (has_headers && header_span.length > 0) {
+            append_row_bytes(header_span);
         }
-
-        out_file.close();
         return true;
     }
 
+    // Write every row whose outcome is known, stopping at the first row still in flight
+    void emit_cleaned_rows() {
+        if (!cleaned_file.is_open()) {
+            return;
+        }
+        while (cleaned_cursor < rows.size()) {
+            RowState state = rows[cleaned_cursor].state;
+            if (state == row_duplicate) {
+                state = rows[item_rows[duplicate_rows[cleaned_cursor]]].state;
+            }
+            if (state == row_pending) {
+                break;
+            }
+            if (state == row_kept) {
+                append_row_bytes(rows[cleaned_cursor]);
+            }
+            cleaned_cursor++;
+        }
+    }
+
+    bool finish_cleaned_csv() {
+        if (!cleaned_file.is_open()) {
+            return false;
+        }
+        emit_cleaned_rows();
+        cleaned_file.write(cleaned_buffer.data(), cleaned_buffer.size());
+        cleaned_buffer.clear();
+        bool ok = static_cast<bool>(cleaned_file);
+        cleaned_file.close();
+        return ok;
+    }
+
     // Getters
     int get_panoid_column_index() const { return panoid_column_index; }
     char get_delimiter() const { return delimiter; }
     bool has_header_row() const { return has_headers; }
     size_t row_count() const { return rows.size(); }
+    size_t duplicate_count() const { return duplicate_rows.size(); }
     std::string get_file_path() const { return file_path; }
 };
 
@@ -324,6 +1092,18 @@ struct GenerationConfig {
     bool crop;
 };
 
+// Parameters for the rectilinear views cut from each panorama
+struct ViewConfig {
+    int output_size = 512;
+    int num_views = 8;
+    double hfov_deg = 90.0;
+    double vfov_deg = 90.0;
+    double rotation_jitter_deg = 22.5;  // Global rotation applied to all directions
+    double fov_jitter_deg = 5.0;        // Per-view vertical FOV jitter
+    double pitch_deg = 5.0;
+    double yaw_deg = 5.0;
+};
+
 // Structure for tile information
 struct Tile {
     int x;
@@ -342,211 +1122,2226 @@ size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* buf
     return total_size;
 }
 
-// Thread pool implementation for optimal parallel processing
+// Cancellation state shared by all work belonging to one panorama. The token is cancelled
+// explicitly once the panorama is lost, or implicitly when its deadline passes; tile tasks
+// check it before starting, while backing off and from inside curl transfers.
+class CancellationToken {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<bool> cancelled;
+    std::atomic<bool> deadline_hit;
+    bool has_deadline;
+    Clock::time_point deadline;
+    std::atomic<int> hard_failures;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::string cancel_reason;
+
+public:
+    // A timeout of zero means no deadline
+    explicit CancellationToken(double timeout_seconds = 0) :
+        cancelled(false), deadline_hit(false), has_deadline(timeout_seconds > 0), hard_failures(0) {
+        if (has_deadline) {
+            deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(timeout_seconds));
+        }
+    }
+
+    // Returns false if the token was already cancelled for another reason
+    bool cancel(const std::string& reason) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (cancelled) {
+                return false;
+            }
+            cancel_reason = reason;
+            cancelled = true;
+        }
+        condition.notify_all();
+        return true;
+    }
+
+    bool is_cancelled() {
+        if (cancelled) {
+            return true;
+        }
+        if (has_deadline && Clock::now() >= deadline) {
+            if (cancel("deadline exceeded")) {
+                deadline_hit = true;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    // True when the cancellation came from the deadline rather than an explicit cancel
+    bool timed_out() const { return deadline_hit; }
+
+    // Whether the token has been cancelled, without checking the deadline again
+    bool was_cancelled() const { return cancelled; }
+
+    std::string reason() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return cancel_reason;
+    }
+
+    // Sleep for the given time unless cancelled first; returns false if cancelled
+    bool sleep_for(std::chrono::duration<double> duration) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            Clock::time_point until = Clock::now() + std::chrono::duration_cast<Clock::duration>(duration);
+            if (has_deadline) {
+                until = std::min(until, deadline);
+            }
+            condition.wait_until(lock, until, [this] { return cancelled.load(); });
+        }
+        return !is_cancelled();
+    }
+
+    // Milliseconds left before the deadline, or -1 without a deadline
+    long remaining_ms() const {
+        if (!has_deadline) {
+            return -1;
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return std::max<long>(1, static_cast<long>(left));
+    }
+
+    int add_hard_failure() { return ++hard_failures; }
+};
+
+// CURL progress callback; a non-zero return aborts the transfer once the token is cancelled
+int TransferCancelCallback(void* clientp, curl_off_t, curl_off_t, curl_off_t, curl_off_t) {
+    CancellationToken* token = static_cast<CancellationToken*>(clientp);
+    return token && token->is_cancelled() ? 1 : 0;
+}
+
+// Per-panorama counters filled in by the tile and generation-probe requests
+struct TileFetchStats {
+    std::atomic<int> retried_tiles{ 0 };
+    std::atomic<int> blank_tiles{ 0 };
+    std::atomic<int> transport_errors{ 0 };
+    std::atomic<int> last_http_status{ 0 };     // Last status other than 200, or 0
+    std::atomic<uint64_t> bytes{ 0 };
+
+    // Throttling, server errors and transport errors may succeed on a later run
+    bool saw_transient_error() const {
+        int status = last_http_status.load();
+        return transport_errors > 0 || status == 429 || status >= 500;
+    }
+};
+
+// Blank tile detection working on the compressed payload instead of a full decode
+class TileValidator {
+private:
+    // Payloads above this size cannot be a uniform black tile, so they are accepted as-is
+    static constexpr size_t blank_candidate_max_bytes = 16 * 1024;
+    // Any reduced-resolution pixel brighter than this means the tile has content
+    static constexpr uchar blank_pixel_threshold = 2;
+
+    // Fingerprints of payloads already confirmed to be blank placeholders
+    std::unordered_set<uint64_t> known_blank_hashes;
+    mutable std::shared_mutex hashes_mutex;
+
+    static bool is_jpeg(const std::string& payload) {
+        return payload.size() > 4 &&
+            static_cast<unsigned char>(payload[0]) == 0xFF &&
+            static_cast<unsigned char>(payload[1]) == 0xD8;
+    }
+
+    // Early-exit scan for any pixel above the blank threshold
+    static bool has_bright_pixel(const uchar* data, size_t length) {
+        size_t i = 0;
+#ifdef HAVE_SSE2
+        const __m128i threshold = _mm_set1_epi8(static_cast<char>(blank_pixel_threshold));
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= length; i += 16) {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            // Saturating subtract leaves non-zero lanes only where pixel > threshold
+            __m128i excess = _mm_subs_epu8(pixels, threshold);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(excess, zero)) != 0xFFFF) {
+                return true;
+            }
+        }
+#endif
+        for (; i < length; ++i) {
+            if (data[i] > blank_pixel_threshold) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Decode at 1/8 scale in grayscale, which libjpeg serves from the DC coefficients alone
+    static bool decodes_to_blank(const std::string& payload) {
+        cv::Mat raw(1, static_cast<int>(payload.size()), CV_8UC1, const_cast<char*>(payload.data()));
+        cv::Mat reduced = cv::imdecode(raw, cv::IMREAD_REDUCED_GRAYSCALE_8);
+        if (reduced.empty()) {
+            return true;  // Undecodable payloads are treated like blank tiles
+        }
+
+        if (reduced.isContinuous()) {
+            return !has_bright_pixel(reduced.ptr(), reduced.total());
+        }
+        for (int row = 0; row < reduced.rows; ++row) {
+            if (has_bright_pixel(reduced.ptr(row), reduced.cols)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // Check if a tile payload holds real imagery (not a black placeholder)
+    bool is_valid(const std::string& payload) {
+        if (payload.empty()) {
+            return false;
+        }
+
+        // Large JPEGs always carry content, no need to look further
+        bool jpeg = is_jpeg(payload);
+        if (jpeg && payload.size() > blank_candidate_max_bytes) {
+            return true;
+        }
+
+        uint64_t hash = fnv1a_hash(payload);
+        {
+            std::shared_lock<std::shared_mutex> lock(hashes_mutex);
+            if (known_blank_hashes.count(hash)) {
+                return false;
+            }
+        }
+
+        if (!decodes_to_blank(payload)) {
+            return true;
+        }
+
+        // Remember this placeholder so identical payloads are rejected without decoding
+        std::unique_lock<std::shared_mutex> lock(hashes_mutex);
+        known_blank_hashes.insert(hash);
+        return false;
+    }
+};
+
+// Move-only type-erased callable. Callables that fit the inline buffer are stored in place,
+// so queuing a small lambda or a packaged_task does not allocate.
+class Task {
+private:
+    static constexpr size_t inline_size = 64;
+
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    template<class F>
+    struct InlineOps {
+        static void invoke(void* p) { (*static_cast<F*>(p))(); }
+        static void move(void* dst, void* src) {
+            new (dst) F(std::move(*static_cast<F*>(src)));
+            static_cast<F*>(src)->~F();
+        }
+        static void destroy(void* p) { static_cast<F*>(p)->~F(); }
+        static constexpr Ops table = { invoke, move, destroy };
+    };
+
+    template<class F>
+    struct HeapOps {
+        static void invoke(void* p) { (**static_cast<F**>(p))(); }
+        static void move(void* dst, void* src) { *static_cast<F**>(dst) = *static_cast<F**>(src); }
+        static void destroy(void* p) { delete *static_cast<F**>(p); }
+        static constexpr Ops table = { invoke, move, destroy };
+    };
+
+    alignas(std::max_align_t) unsigned char storage[inline_size];
+    const Ops* ops;
+
+public:
+    Task() : ops(nullptr) {}
+
+    template<class F, class Fn = typename std::decay<F>::type,
+        class = typename std::enable_if<!std::is_same<Fn, Task>::value>::type>
+    Task(F&& f) {
+        if constexpr (sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<Fn>::value) {
+            new (storage) Fn(std::forward<F>(f));
+            ops = &InlineOps<Fn>::table;
+        }
+        else {
+            *reinterpret_cast<Fn**>(storage) = new Fn(std::forward<F>(f));
+            ops = &HeapOps<Fn>::table;
+        }
+    }
+
+    Task(Task&& other) noexcept : ops(other.ops) {
+        if (ops) {
+            ops->move(storage, other.storage);
+            other.ops = nullptr;
+        }
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            ops = other.ops;
+            if (ops) {
+                ops->move(storage, other.storage);
+                other.ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    void reset() {
+        if (ops) {
+            ops->destroy(storage);
+            ops = nullptr;
+        }
+    }
+
+    explicit operator bool() const { return ops != nullptr; }
+
+    void operator()() { ops->invoke(storage); }
+};
+
+// Work-stealing thread pool. Each worker owns a lock-free deque that it drains first, newest
+// task first, so a panorama works through its own tiles depth-first; idle workers steal the
+// oldest tasks from the others. Tasks that wait on subtasks call wait(), which keeps running
+// queued work instead of blocking the worker, so nested parallelism (panoramas enqueueing
+// tiles) cannot starve the pool. Idle workers spin briefly before parking on a condition
+// variable, and producers only take the lock to wake someone when a worker is parked.
+//
+// Tasks posted from outside the pool (panoramas) go to a separate injection queue, and tasks
+// posted by workers (tiles) are treated as leaves. wait() only helps with leaves, so a waiting
+// panorama never starts another panorama on its own stack.
+//
+// Tasks submitted under a PriorityScope carry its priority; subtasks inherit the priority of
+// the task that submits them, so all of a panorama's tiles share its admission order. Each
+// deque records the priority of its tasks, and idle workers steal from the deque with the
+// lowest value, so the earliest admitted panorama gets help first.
 class ThreadPool {
+public:
+    static constexpr uint64_t no_priority = UINT64_MAX;
+
+private:
+    struct WorkerQueue {
+        WorkStealingDeque<Task> tasks;
+        std::atomic<uint64_t> priority;     // Of the task that last pushed here
+
+        explicit WorkerQueue(size_t capacity) : tasks(capacity), priority(no_priority) {}
+    };
+
+    struct OverflowTask {
+        uint64_t priority;
+        Task task;
+    };
+
+    static constexpr size_t queue_capacity = 1024;
+    static constexpr int spin_limit = 256;
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::mutex overflow_mutex;
+    std::deque<OverflowTask> overflow;  // Spill-over when a worker queue is full
+    std::atomic<size_t> overflow_size;
+    MPMCQueue<Task> injected;           // Tasks posted from outside the pool
+    std::mutex injected_overflow_mutex;
+    std::deque<Task> injected_overflow; // Spill-over when the injection queue is full
+    std::atomic<size_t> injected_overflow_size;
+    std::atomic<size_t> pending;        // Tasks queued but not yet taken
+    std::atomic<int> sleepers;
+    std::mutex sleep_mutex;
+    std::condition_variable condition;
+    std::atomic<bool> stop;
+
+    // Identifies the pool and queue owned by the calling thread, if it is a worker
+    inline static thread_local ThreadPool* current_pool = nullptr;
+    inline static thread_local size_t current_index = 0;
+    inline static thread_local uint64_t current_priority = no_priority;
+
+    // Steal the oldest task from the deque with the lowest priority value
+    bool steal(size_t index, Task& task, uint64_t& priority) {
+        size_t count = queues.size();
+        size_t victim = count;
+        uint64_t lowest = no_priority;
+        for (size_t i = 1; i < count; ++i) {
+            size_t candidate = (index + i) % count;
+            const WorkerQueue& queue = *queues[candidate];
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            uint64_t candidate_priority = queue.priority.load(std::memory_order_relaxed);
+            if (victim == count || candidate_priority < lowest) {
+                victim = candidate;
+                lowest = candidate_priority;
+            }
+        }
+
+        if (victim == count) {
+            return false;
+        }
+        if (queues[victim]->tasks.try_steal(task)) {
+            priority = lowest;
+            return true;
+        }
+
+        // Lost the race for that task; take any other
+        for (size_t i = 1; i < count; ++i) {
+            WorkerQueue& queue = *queues[(index + i) % count];
+            if (queue.tasks.try_steal(task)) {
+                priority = queue.priority.load(std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Leaves only when called from wait(); idle workers also admit tasks from outside the pool
+    bool pop_task(size_t index, Task& task, uint64_t& priority, bool leaves_only) {
+        priority = no_priority;
+
+        // Own tasks first, newest first
+        WorkerQueue& own = *queues[index];
+        bool found = own.tasks.try_pop(task);
+        if (found) {
+            priority = own.priority.load(std::memory_order_relaxed);
+        }
+
+        // New panoramas are admitted before helping others, so admission never waits for tiles
+        if (!found && !leaves_only) {
+            found = injected.try_pop(task);
+            if (!found && injected_overflow_size > 0) {
+                std::lock_guard<std::mutex> lock(injected_overflow_mutex);
+                if (!injected_overflow.empty()) {
+                    task = std::move(injected_overflow.front());
+                    injected_overflow.pop_front();
+                    injected_overflow_size--;
+                    found = true;
+                }
+            }
+        }
+
+        if (!found) {
+            found = steal(index, task, priority);
+        }
+
+        if (!found && overflow_size > 0) {
+            std::lock_guard<std::mutex> lock(overflow_mutex);
+            if (!overflow.empty()) {
+                task = std::move(overflow.front().task);
+                priority = overflow.front().priority;
+                overflow.pop_front();
+                overflow_size--;
+                found = true;
+            }
+        }
+
+        if (found) {
+            pending--;
+        }
+        return found;
+    }
+
+    bool run_one(size_t index, bool leaves_only) {
+        Task task;
+        uint64_t priority;
+        if (!pop_task(index, task, priority, leaves_only)) {
+            return false;
+        }
+        PriorityScope scope(priority);
+        task();
+        return true;
+    }
+
+    void push(Task task) {
+        // Count the task before publishing it, so a worker that takes it at once cannot
+        // decrement first and wrap the counter
+        pending++;
+        if (current_pool == this) {
+            // Workers keep their own subtasks local
+            WorkerQueue& own = *queues[current_index];
+            if (own.priority.load(std::memory_order_relaxed) != current_priority) {
+                own.priority.store(current_priority, std::memory_order_relaxed);
+            }
+            if (!own.tasks.try_push(task)) {
+                std::lock_guard<std::mutex> lock(overflow_mutex);
+                overflow.push_back({ current_priority, std::move(task) });
+                overflow_size++;
+            }
+        }
+        else if (!injected.try_push(task)) {
+            std::lock_guard<std::mutex> lock(injected_overflow_mutex);
+            injected_overflow.push_back(std::move(task));
+            injected_overflow_size++;
+        }
+
+        if (sleepers > 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            condition.notify_one();
+        }
+    }
+
+public:
+    // Tasks submitted by this thread while the scope is alive carry the given priority
+    class PriorityScope {
+    private:
+        uint64_t saved;
+
+    public:
+        explicit PriorityScope(uint64_t priority) : saved(current_priority) { current_priority = priority; }
+        ~PriorityScope() { current_priority = saved; }
+        PriorityScope(const PriorityScope&) = delete;
+        PriorityScope& operator=(const PriorityScope&) = delete;
+    };
+
+    ThreadPool(size_t threads) : overflow_size(0), injected(queue_capacity), injected_overflow_size(0),
+        pending(0), sleepers(0), stop(false) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i) {
+            queues.push_back(std::make_unique<WorkerQueue>(queue_capacity));
+        }
+
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back([this, i] {
+                current_pool = this;
+                current_index = i;
+                while (true) {
+                    if (run_one(i, false)) {
+                        continue;
+                    }
+
+                    // Spin briefly; new work usually arrives within microseconds
+                    bool has_work = false;
+                    for (int spin = 0; spin < spin_limit && !has_work; ++spin) {
+                        cpu_relax();
+                        has_work = pending > 0;
+                    }
+                    if (has_work) {
+                        continue;
+                    }
+
+                    sleepers++;
+                    {
+                        std::unique_lock<std::mutex> lock(sleep_mutex);
+                        condition.wait(lock, [this] { return stop || pending > 0; });
+                    }
+                    sleepers--;
+                    if (stop && pending == 0) {
+                        return;
+                    }
+                }
+                });
+        }
+    }
+
+    // Fire-and-forget submission: no future, no shared state
+    template<class F>
+    void post(F&& f) {
+        if (stop) {
+            throw std::runtime_error("enqueue on stopped ThreadPool");
+        }
+        push(Task(std::forward<F>(f)));
+    }
+
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type> {
+        using return_type = typename std::result_of<F(Args...)>::type;
+
+        std::packaged_task<return_type()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<return_type> result = task.get_future();
+        post(std::move(task));
+        return result;
+    }
+
+    size_t queued() const { return pending; }
+
+    // Wait for a future; on a worker thread, run queued leaf tasks until it is ready
+    template<class T>
+    T wait(std::future<T>& future) {
+        if (current_pool == this) {
+            while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                if (!run_one(current_index, true)) {
+                    // Nothing left to help with; the subtask is running on another worker
+                    future.wait_for(std::chrono::microseconds(200));
+                }
+            }
+        }
+        return future.get();
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+// Fixed-size executor for one pipeline stage. Its queue is bounded, so a stage that falls
+// behind blocks its producers instead of buffering without limit, and the depth counters
+// show which stage is the bottleneck.
+class StageExecutor {
 private:
+    std::string stage_name;
     std::vector<std::thread> workers;
     std::queue<std::function<void()>> tasks;
     std::mutex queue_mutex;
-    std::condition_variable condition;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    size_t capacity;
+    size_t peak;
+    std::atomic<size_t> running;
     bool stop;
 
-public:
-    ThreadPool(size_t threads) : stop(false) {
-        for (size_t i = 0; i < threads; ++i) {
-            workers.emplace_back([this] {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex);
-                        condition.wait(lock, [this] { return stop || !tasks.empty(); });
-                        if (stop && tasks.empty()) {
-                            return;
-                        }
-                        task = std::move(tasks.front());
-                        tasks.pop();
+public:
+    StageExecutor(std::string name, size_t threads, size_t queue_capacity) :
+        stage_name(std::move(name)), capacity(std::max<size_t>(1, queue_capacity)),
+        peak(0), running(0), stop(false) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex);
+                        not_empty.wait(lock, [this] { return stop || !tasks.empty(); });
+                        if (stop && tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                        running++;
+                    }
+                    not_full.notify_one();
+                    task();
+                    running--;
+                }
+                });
+        }
+    }
+
+    // Queue a task for this stage; blocks while the stage queue is full
+    template<class F>
+    auto submit(F&& f) -> std::future<typename std::result_of<F()>::type> {
+        using return_type = typename std::result_of<F()>::type;
+
+        auto task = std::make_shared<std::packaged_task<return_type()>>(std::forward<F>(f));
+        std::future<return_type> result = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            not_full.wait(lock, [this] { return stop || tasks.size() < capacity; });
+            if (stop) {
+                throw std::runtime_error("submit on stopped stage " + stage_name);
+            }
+            tasks.emplace([task]() { (*task)(); });
+            peak = std::max(peak, tasks.size());
+        }
+        not_empty.notify_one();
+        return result;
+    }
+
+    const std::string& name() const { return stage_name; }
+    size_t thread_count() const { return workers.size(); }
+    size_t queue_capacity() const { return capacity; }
+    size_t active() const { return running; }
+
+    size_t depth() {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return tasks.size();
+    }
+
+    size_t peak_depth() {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return peak;
+    }
+
+    ~StageExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stop = true;
+        }
+        not_empty.notify_all();
+        not_full.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+};
+
+// Fixed-size index record so the index file can be memory-mapped and searched directly
+#pragma pack(push, 1)
+struct ShardIndexEntry {
+    char panoid[32];      // Zero-padded PanoID
+    uint32_t shard;       // Shard number (views-NNNNNN.tar)
+    uint32_t view;        // 1-based view index
+    uint64_t offset;      // Offset of the JPEG data inside the shard
+    uint64_t size;        // JPEG size in bytes
+};
+#pragma pack(pop)
+
+// Appends encoded views to size-capped, WebDataset-compatible tar shards
+class ShardWriter {
+private:
+    static constexpr size_t tar_block = 512;
+    static constexpr size_t write_buffer_size = 8 * 1024 * 1024;
+
+    fs::path output_dir;
+    uint64_t max_shard_bytes;
+    uint32_t shard_number;
+    uint64_t shard_bytes;
+    std::ofstream shard_file;
+    std::ofstream index_file;
+    std::vector<char> buffer;
+    std::vector<char> index_buffer;
+    std::mutex shard_mutex;
+
+    // Views 1-64 of each PanoID that earlier runs recorded in views.idx, as a bit mask
+    std::unordered_map<std::string, uint64_t> indexed_views;
+
+    fs::path shard_path(uint32_t number) const {
+        std::ostringstream name;
+        name << "views-" << std::setw(6) << std::setfill('0') << number << ".tar";
+        return output_dir / name.str();
+    }
+
+    void flush_buffers() {
+        if (!buffer.empty()) {
+            shard_file.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+        if (!index_buffer.empty()) {
+            index_file.write(index_buffer.data(), index_buffer.size());
+            index_buffer.clear();
+        }
+    }
+
+    // Remember which views earlier runs stored; a torn record at the end is ignored
+    void load_index(const fs::path& index_path) {
+        std::ifstream index(index_path, std::ios::binary);
+        ShardIndexEntry entry;
+        while (index.read(reinterpret_cast<char*>(&entry), sizeof(entry))) {
+            if (entry.view >= 1 && entry.view <= 64) {
+                std::string panoid(entry.panoid, strnlen(entry.panoid, sizeof(entry.panoid)));
+                indexed_views[panoid] |= 1ULL << (entry.view - 1);
+            }
+        }
+    }
+
+    void open_shard() {
+        shard_file.open(shard_path(shard_number), std::ios::binary | std::ios::trunc);
+        if (!shard_file.is_open()) {
+            throw std::runtime_error("Could not open shard: " + shard_path(shard_number).string());
+        }
+        shard_bytes = 0;
+    }
+
+    // Terminate the archive with two zero blocks and start the next shard
+    void close_shard() {
+        if (!shard_file.is_open()) {
+            return;
+        }
+        buffer.insert(buffer.end(), tar_block * 2, '\0');
+        flush_buffers();
+        shard_file.close();
+    }
+
+    // Build a ustar header for a regular file member
+    static void write_tar_header(char* header, const std::string& name, size_t size) {
+        std::memset(header, 0, tar_block);
+        std::strncpy(header, name.c_str(), 99);
+        std::snprintf(header + 100, 8, "%07o", 0644);
+        std::snprintf(header + 108, 8, "%07o", 0);
+        std::snprintf(header + 116, 8, "%07o", 0);
+        std::snprintf(header + 124, 12, "%011llo", static_cast<unsigned long long>(size));
+        std::snprintf(header + 136, 12, "%011llo",
+            static_cast<unsigned long long>(std::time(nullptr)));
+        header[156] = '0';
+        std::memcpy(header + 257, "ustar", 6);
+        std::memcpy(header + 263, "00", 2);
+
+        // Checksum is computed with the checksum field filled with spaces
+        std::memset(header + 148, ' ', 8);
+        unsigned int checksum = 0;
+        for (size_t i = 0; i < tar_block; ++i) {
+            checksum += static_cast<unsigned char>(header[i]);
+        }
+        std::snprintf(header + 148, 8, "%06o", checksum);
+        header[155] = ' ';
+    }
+
+public:
+    ShardWriter(const fs::path& dir, uint64_t max_bytes) :
+        output_dir(dir), max_shard_bytes(max_bytes), shard_number(0), shard_bytes(0) {
+        // Continue numbering after shards left by earlier runs
+        while (fs::exists(shard_path(shard_number))) {
+            shard_number++;
+        }
+        buffer.reserve(write_buffer_size);
+        load_index(output_dir / "views.idx");
+        index_file.open(output_dir / "views.idx", std::ios::binary | std::ios::app);
+        if (!index_file.is_open()) {
+            throw std::runtime_error("Could not open shard index in " + output_dir.string());
+        }
+        open_shard();
+    }
+
+    // Append one encoded view as <panoid>.<member_suffix> to the current shard
+    bool append(const std::string& panoid, int view, const std::string& member_suffix,
+        const std::vector<uchar>& data) {
+        std::lock_guard<std::mutex> lock(shard_mutex);
+
+        size_t padded = (data.size() + tar_block - 1) / tar_block * tar_block;
+        uint64_t record_bytes = tar_block + padded;
+
+        // Roll over to a new shard when this record would exceed the cap
+        if (shard_bytes > 0 && shard_bytes + record_bytes + tar_block * 2 > max_shard_bytes) {
+            close_shard();
+            shard_number++;
+            open_shard();
+        }
+
+        size_t header_pos = buffer.size();
+        buffer.resize(header_pos + tar_block);
+        write_tar_header(buffer.data() + header_pos, panoid + "." + member_suffix, data.size());
+        buffer.insert(buffer.end(), data.begin(), data.end());
+        buffer.resize(buffer.size() + (padded - data.size()), '\0');
+
+        ShardIndexEntry entry{};
+        std::strncpy(entry.panoid, panoid.c_str(), sizeof(entry.panoid) - 1);
+        entry.shard = shard_number;
+        entry.view = static_cast<uint32_t>(view);
+        entry.offset = shard_bytes + tar_block;
+        entry.size = data.size();
+        const char* entry_bytes = reinterpret_cast<const char*>(&entry);
+        index_buffer.insert(index_buffer.end(), entry_bytes, entry_bytes + sizeof(entry));
+
+        shard_bytes += record_bytes;
+
+        // Write out in large sequential chunks
+        if (buffer.size() >= write_buffer_size) {
+            flush_buffers();
+        }
+        return static_cast<bool>(shard_file) && static_cast<bool>(index_file);
+    }
+
+    // Whether an earlier run already stored views 1..views of the panorama
+    bool contains(const std::string& panoid, int views) const {
+        auto found = indexed_views.find(panoid.substr(0, sizeof(ShardIndexEntry::panoid) - 1));
+        if (found == indexed_views.end() || views < 1 || views > 64) {
+            return false;
+        }
+        uint64_t wanted = views == 64 ? ~0ULL : (1ULL << views) - 1;
+        return (found->second & wanted) == wanted;
+    }
+
+    // Write buffered members and index records out; the current shard stays open for appends
+    void flush() {
+        std::lock_guard<std::mutex> lock(shard_mutex);
+        flush_buffers();
+        shard_file.flush();
+        index_file.flush();
+    }
+
+    // Terminate the current shard; only at shutdown, nothing can be appended afterwards
+    void close() {
+        std::lock_guard<std::mutex> lock(shard_mutex);
+        close_shard();
+        flush_buffers();
+        index_file.flush();
+    }
+
+    ~ShardWriter() {
+        close();
+    }
+};
+
+// Log-linear latency histogram in microseconds (HDR-style): every power-of-two range is split
+// into sub_buckets linear buckets, which keeps ~12% relative precision from 1 us to hours.
+// Recording is a couple of relaxed atomic increments, cheap enough for every hot path.
+class LatencyHistogram {
+public:
+    static constexpr int sub_bucket_bits = 3;
+    static constexpr int sub_buckets = 1 << sub_bucket_bits;
+    static constexpr int exponents = 36;
+    static constexpr int bucket_count = exponents * sub_buckets;
+
+private:
+    std::array<std::atomic<uint64_t>, bucket_count> buckets;
+    std::atomic<uint64_t> total_count;
+    std::atomic<uint64_t> total_sum;
+
+    static int highest_bit(uint64_t value) {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<int>(index);
+#else
+        return 63 - __builtin_clzll(value);
+#endif
+    }
+
+    static int bucket_index(uint64_t value) {
+        if (value < static_cast<uint64_t>(sub_buckets)) {
+            return static_cast<int>(value);
+        }
+        int msb = highest_bit(value);
+        int exponent = msb - sub_bucket_bits + 1;
+        int sub = static_cast<int>((value >> (msb - sub_bucket_bits)) & (sub_buckets - 1));
+        return std::min(exponent * sub_buckets + sub, bucket_count - 1);
+    }
+
+    // Smallest value that falls into the bucket after this one
+    static uint64_t bucket_limit(int index) {
+        int exponent = index / sub_buckets;
+        int sub = index % sub_buckets;
+        if (exponent == 0) {
+            return sub + 1;
+        }
+        return static_cast<uint64_t>(sub_buckets + sub + 1) << (exponent - 1);
+    }
+
+public:
+    LatencyHistogram() : total_count(0), total_sum(0) {
+        for (auto& bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t micros) {
+        buckets[bucket_index(micros)].fetch_add(1, std::memory_order_relaxed);
+        total_count.fetch_add(1, std::memory_order_relaxed);
+        total_sum.fetch_add(micros, std::memory_order_relaxed);
+    }
+
+    void record_since(std::chrono::steady_clock::time_point start) {
+        record(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    uint64_t count() const { return total_count.load(std::memory_order_relaxed); }
+
+    // Forget every sample; records racing with the reset may be kept or lost
+    void clear() {
+        for (auto& bucket : buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        total_count.store(0, std::memory_order_relaxed);
+        total_sum.store(0, std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the q-th quantile, in microseconds
+    uint64_t quantile(double q) const {
+        return quantile(q, nullptr);
+    }
+
+    // The same over the samples of this histogram and other together
+    uint64_t quantile(double q, const LatencyHistogram* other) const {
+        uint64_t total = count() + (other ? other->count() : 0);
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(std::ceil(q * total));
+        uint64_t seen = 0;
+        for (int i = 0; i < bucket_count; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (other) {
+                seen += other->buckets[i].load(std::memory_order_relaxed);
+            }
+            if (seen >= rank) {
+                return bucket_limit(i);
+            }
+        }
+        return bucket_limit(bucket_count - 1);
+    }
+
+    // Prometheus histogram with power-of-two boundaries from 16 us to 2^37 us (~38 hours)
+    void write_prometheus(std::string& out, const std::string& name, const std::string& help) const {
+        std::string metric = "streetview_" + name + "_seconds";
+        out += "# HELP " + metric + " " + help + "\n";
+        out += "# TYPE " + metric + " histogram\n";
+
+        uint64_t cumulative = 0;
+        int index = 0;
+        for (int exponent = 4; exponent < exponents - 1 + sub_bucket_bits; ++exponent) {
+            uint64_t limit = 1ULL << exponent;
+            while (index < bucket_count && bucket_limit(index) <= limit) {
+                cumulative += buckets[index++].load(std::memory_order_relaxed);
+            }
+            std::ostringstream le;
+            le << static_cast<double>(limit) / 1e6;
+            out += metric + "_bucket{le=\"" + le.str() + "\"} " + std::to_string(cumulative) + "\n";
+        }
+
+        std::ostringstream sum;
+        sum << static_cast<double>(total_sum.load(std::memory_order_relaxed)) / 1e6;
+        out += metric + "_bucket{le=\"+Inf\"} " + std::to_string(count()) + "\n";
+        out += metric + "_sum " + sum.str() + "\n";
+        out += metric + "_count " + std::to_string(count()) + "\n";
+    }
+};
+
+// Latency over the last one to two windows, so percentiles follow the tile service as it
+// slows down or recovers instead of averaging over the whole run. Samples go into the
+// current window's histogram; the older one is cleared and reused when a window ends.
+class RecentLatency {
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::array<LatencyHistogram, 2> windows;
+    Clock::time_point origin;
+    Clock::duration window_length;
+    std::atomic<int64_t> current_window;
+    std::mutex rotate_mutex;
+
+    // Index of the current window, starting a new one first if the current one has ended
+    int64_t rotate() {
+        int64_t now_window = (Clock::now() - origin) / window_length;
+        int64_t window = current_window.load(std::memory_order_acquire);
+        if (now_window > window) {
+            std::lock_guard<std::mutex> lock(rotate_mutex);
+            window = current_window.load(std::memory_order_relaxed);
+            if (now_window > window) {
+                // After an idle gap the previous window is stale as well
+                if (now_window > window + 1) {
+                    windows[(now_window + 1) & 1].clear();
+                }
+                windows[now_window & 1].clear();
+                current_window.store(now_window, std::memory_order_release);
+                window = now_window;
+            }
+        }
+        return window;
+    }
+
+public:
+    explicit RecentLatency(std::chrono::seconds length) :
+        origin(Clock::now()), window_length(length), current_window(0) {}
+
+    void record(uint64_t micros) {
+        windows[rotate() & 1].record(micros);
+    }
+
+    uint64_t count() {
+        rotate();
+        return windows[0].count() + windows[1].count();
+    }
+
+    uint64_t quantile(double q) {
+        rotate();
+        return windows[0].quantile(q, &windows[1]);
+    }
+};
+
+// Records the lifetime of the scope into a histogram
+class ScopedTimer {
+private:
+    LatencyHistogram& histogram;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    explicit ScopedTimer(LatencyHistogram& target) :
+        histogram(target), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { histogram.record_since(start); }
+};
+
+// Latency histograms and counters for every pipeline stage, exportable in Prometheus text format
+class Metrics {
+public:
+    LatencyHistogram dns;
+    LatencyHistogram connect;
+    LatencyHistogram tls;
+    LatencyHistogram ttfb;
+    LatencyHistogram tile_fetch;
+    LatencyHistogram tile_validate;
+    LatencyHistogram tile_decode;
+    LatencyHistogram stitch;
+    LatencyHistogram projection;
+    LatencyHistogram encode;
+    LatencyHistogram write;
+
+    std::atomic<uint64_t> tile_requests{ 0 };
+    std::atomic<uint64_t> tile_retries{ 0 };
+    std::atomic<uint64_t> transfer_errors{ 0 };
+    std::atomic<uint64_t> bytes_downloaded{ 0 };
+    std::atomic<uint64_t> views_written{ 0 };
+    std::atomic<uint64_t> panoramas_succeeded{ 0 };
+    std::atomic<uint64_t> panoramas_failed{ 0 };
+    std::atomic<uint64_t> panoramas_requeued{ 0 };
+    std::atomic<uint64_t> breaker_trips{ 0 };
+    std::atomic<uint64_t> breaker_probes{ 0 };
+    std::atomic<uint64_t> hedges_sent{ 0 };
+    std::atomic<uint64_t> hedges_won{ 0 };
+    std::array<std::atomic<uint64_t>, 600> http_responses{};
+
+    void count_response(long code) {
+        if (code >= 0 && code < static_cast<long>(http_responses.size())) {
+            http_responses[code].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    std::string to_prometheus() const {
+        std::string out;
+        dns.write_prometheus(out, "dns", "DNS resolution time of tile requests");
+        connect.write_prometheus(out, "connect", "TCP connect time of tile requests");
+        tls.write_prometheus(out, "tls", "TLS handshake time of tile requests");
+        ttfb.write_prometheus(out, "ttfb", "Time from request sent to first response byte");
+        tile_fetch.write_prometheus(out, "tile_fetch", "Total time of one tile transfer");
+        tile_validate.write_prometheus(out, "tile_validate", "Blank tile check time");
+        tile_decode.write_prometheus(out, "tile_decode", "Tile JPEG decode time");
+        stitch.write_prometheus(out, "stitch", "Panorama stitch time");
+        projection.write_prometheus(out, "projection", "Time to project one directional view");
+        encode.write_prometheus(out, "encode", "View JPEG encode time");
+        write.write_prometheus(out, "write", "Time to write one view to disk");
+
+        auto counter = [&out](const std::string& name, const std::string& help, uint64_t value) {
+            out += "# HELP streetview_" + name + " " + help + "\n";
+            out += "# TYPE streetview_" + name + " counter\n";
+            out += "streetview_" + name + " " + std::to_string(value) + "\n";
+        };
+        counter("tile_requests_total", "Tile HTTP requests issued", tile_requests);
+        counter("tile_retries_total", "Tile requests that were retries", tile_retries);
+        counter("transfer_errors_total", "Tile transfers that failed below HTTP", transfer_errors);
+        counter("downloaded_bytes_total", "Tile bytes received", bytes_downloaded);
+        counter("views_written_total", "Directional views written", views_written);
+        counter("panoramas_succeeded_total", "Panoramas processed successfully", panoramas_succeeded);
+        counter("panoramas_failed_total", "Panoramas that failed", panoramas_failed);
+        counter("panoramas_requeued_total", "Panoramas re-queued after a tile service outage", panoramas_requeued);
+        counter("breaker_trips_total", "Times the circuit breaker paused downloads", breaker_trips);
+        counter("breaker_probes_total", "Probe requests sent while the circuit breaker was open", breaker_probes);
+        counter("hedges_sent_total", "Duplicate requests sent for slow tiles", hedges_sent);
+        counter("hedges_won_total", "Hedged requests that answered before the original", hedges_won);
+
+        out += "# HELP streetview_http_responses_total Tile responses by HTTP status\n";
+        out += "# TYPE streetview_http_responses_total counter\n";
+        for (size_t code = 0; code < http_responses.size(); ++code) {
+            uint64_t value = http_responses[code].load(std::memory_order_relaxed);
+            if (value > 0) {
+                out += "streetview_http_responses_total{code=\"" + std::to_string(code) + "\"} " +
+                    std::to_string(value) + "\n";
+            }
+        }
+        return out;
+    }
+
+    // One-line p50/p99 digest of the stages that usually dominate, for the end-of-run log
+    std::string summary() const {
+        auto stage = [](const std::string& name, const LatencyHistogram& histogram) {
+            std::ostringstream line;
+            line << name << " " << std::fixed << std::setprecision(1)
+                << histogram.quantile(0.5) / 1000.0 << "/" << histogram.quantile(0.99) / 1000.0;
+            return line.str();
+        };
+        return "Latency p50/p99 ms: " + stage("ttfb", ttfb) + ", " + stage("fetch", tile_fetch) + ", " +
+            stage("decode", tile_decode) + ", " + stage("stitch", stitch) + ", " +
+            stage("projection", projection) + ", " + stage("encode", encode) + ", " + stage("write", write);
+    }
+};
+
+// Process-wide circuit breaker for the tile service. Every tile and probe request reports its
+// outcome; when 429/5xx/transport errors exceed the threshold over the sliding window, the
+// breaker opens and all fetching pauses. After a cooldown a single probe request is let
+// through: success closes the breaker, failure reopens it with a doubled cooldown.
+class CircuitBreaker {
+public:
+    enum class State { closed, open, half_open };
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr int bucket_count = 10;
+    static constexpr int min_requests = 20;     // Too few samples say nothing about the error rate
+
+    struct Bucket {
+        int64_t slot = -1;
+        int requests = 0;
+        int errors = 0;
+    };
+
+    double threshold;
+    Clock::duration bucket_width;
+    Clock::duration base_cooldown;
+    Clock::duration cooldown;
+    const Clock::duration max_cooldown = std::chrono::seconds(60);
+    std::shared_ptr<Logger> logger;
+    std::shared_ptr<Metrics> metrics;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::array<Bucket, bucket_count> buckets;
+    State state;
+    Clock::time_point retry_at;
+    bool probe_in_flight;
+    std::atomic<uint64_t> trips;
+
+    void reset_window() {
+        for (Bucket& bucket : buckets) {
+            bucket = Bucket();
+        }
+    }
+
+    void open(Clock::time_point now) {
+        state = State::open;
+        retry_at = now + cooldown;
+    }
+
+public:
+    // A threshold of zero disables the breaker
+    CircuitBreaker(double error_threshold, double window_seconds, double cooldown_seconds,
+        std::shared_ptr<Logger> log, std::shared_ptr<Metrics> stats) :
+        threshold(error_threshold),
+        bucket_width(std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(std::max(window_seconds, 1.0) / bucket_count))),
+        base_cooldown(std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(std::max(cooldown_seconds, 0.1)))),
+        cooldown(base_cooldown), logger(std::move(log)), metrics(std::move(stats)),
+        state(State::closed), probe_in_flight(false), trips(0) {}
+
+    bool enabled() const { return threshold > 0; }
+    uint64_t trip_count() const { return trips.load(); }
+
+    bool is_open() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return state != State::closed;
+    }
+
+    // Wait until a request may be sent. probe is set when this request decides whether the
+    // service has recovered. Returns false if the token is cancelled while waiting.
+    bool acquire(CancellationToken* token, bool& probe) {
+        probe = false;
+        if (!enabled()) {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            if (state == State::closed) {
+                return true;
+            }
+
+            Clock::time_point now = Clock::now();
+            if (state == State::open && now >= retry_at) {
+                state = State::half_open;
+            }
+            if (state == State::half_open && !probe_in_flight) {
+                probe_in_flight = true;
+                probe = true;
+                if (metrics) {
+                    metrics->breaker_probes++;
+                }
+                return true;
+            }
+            if (token && token->is_cancelled()) {
+                return false;
+            }
+
+            // Wake periodically so cancelled panoramas leave the queue promptly
+            Clock::time_point until = now + std::chrono::milliseconds(100);
+            if (state == State::open) {
+                until = std::min(until, retry_at);
+            }
+            condition.wait_until(lock, until);
+        }
+    }
+
+    // Report the outcome of a request let through by acquire
+    void record(bool success, bool probe) {
+        if (!enabled()) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+
+        if (probe) {
+            probe_in_flight = false;
+            if (success) {
+                state = State::closed;
+                cooldown = base_cooldown;
+                reset_window();
+                lock.unlock();
+                condition.notify_all();
+                logger->log(LogLevel::warning, "Tile service recovered, resuming downloads");
+            }
+            else {
+                cooldown = std::min(cooldown * 2, max_cooldown);
+                open(now);
+                lock.unlock();
+                condition.notify_all();
+            }
+            return;
+        }
+
+        // Requests that were already in flight when the breaker opened do not count
+        if (state != State::closed) {
+            return;
+        }
+
+        int64_t slot = now.time_since_epoch() / bucket_width;
+        Bucket& bucket = buckets[static_cast<size_t>(slot % bucket_count)];
+        if (bucket.slot != slot) {
+            bucket = Bucket();
+            bucket.slot = slot;
+        }
+        bucket.requests++;
+        if (!success) {
+            bucket.errors++;
+        }
+
+        int requests = 0;
+        int errors = 0;
+        for (const Bucket& b : buckets) {
+            if (b.slot > slot - bucket_count) {
+                requests += b.requests;
+                errors += b.errors;
+            }
+        }
+
+        if (requests >= min_requests && errors >= threshold * requests) {
+            open(now);
+            trips++;
+            if (metrics) {
+                metrics->breaker_trips++;
+            }
+            lock.unlock();
+            logger->log(LogLevel::warning, "Tile service error rate " + std::to_string(errors) + "/" +
+                std::to_string(requests) + " over the last window, pausing downloads");
+        }
+    }
+
+    // A probe that never got an answer (its panorama was cancelled) frees the slot for another
+    void abandon_probe() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            probe_in_flight = false;
+        }
+        condition.notify_all();
+    }
+};
+
+// Append value to out as a quoted JSON string
+inline void append_json_string(std::string& out, const std::string& value) {
+    out += '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+// Records timed spans into per-thread buffers and writes them as Chrome Trace Event JSON
+// (viewable in Perfetto or chrome://tracing). Each thread appends only to its own buffer, so
+// the per-buffer lock is never contended while recording.
+class TraceRecorder {
+private:
+    struct Event {
+        const char* name;
+        const char* category;
+        std::string panoid;
+        std::string detail;
+        uint64_t start;     // Microseconds since the recorder was created
+        uint64_t duration;
+    };
+
+    struct ThreadBuffer {
+        std::mutex mutex;
+        std::vector<Event> events;
+        uint32_t tid;
+    };
+
+    std::atomic<bool> active;
+    std::chrono::steady_clock::time_point origin;
+    std::mutex buffers_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    uint64_t id;
+
+    // The thread-local cache is keyed by a per-recorder id rather than its address, so a
+    // recorder constructed where a destroyed one lived never reuses the old buffer
+    inline static std::atomic<uint64_t> next_id{ 1 };
+    inline static thread_local uint64_t local_owner = 0;
+    inline static thread_local ThreadBuffer* local_buffer = nullptr;
+
+    ThreadBuffer& thread_buffer() {
+        if (local_owner != id) {
+            std::lock_guard<std::mutex> lock(buffers_mutex);
+            buffers.push_back(std::make_unique<ThreadBuffer>());
+            buffers.back()->tid = static_cast<uint32_t>(buffers.size());
+            local_buffer = buffers.back().get();
+            local_owner = id;
+        }
+        return *local_buffer;
+    }
+
+public:
+    TraceRecorder() : active(false), origin(std::chrono::steady_clock::now()),
+        id(next_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+    void enable() { active = true; }
+    bool enabled() const { return active.load(std::memory_order_relaxed); }
+
+    uint64_t now() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void record(const char* name, const char* category, const std::string& panoid,
+        std::string detail, uint64_t start, uint64_t end) {
+        ThreadBuffer& buffer = thread_buffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.events.push_back({ name, category, panoid, std::move(detail), start, end - start });
+    }
+
+    // Write all spans recorded so far as complete ("X") events
+    bool write(const std::string& path) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        std::lock_guard<std::mutex> buffers_lock(buffers_mutex);
+        for (const auto& buffer : buffers) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            for (const Event& event : buffer->events) {
+                if (!first) {
+                    out += ",\n";
+                }
+                first = false;
+                out += "{\"name\":\"";
+                out += event.name;
+                out += "\",\"cat\":\"";
+                out += event.category;
+                out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(buffer->tid) +
+                    ",\"ts\":" + std::to_string(event.start) + ",\"dur\":" + std::to_string(event.duration) +
+                    ",\"args\":{\"panoid\":";
+                append_json_string(out, event.panoid);
+                if (!event.detail.empty()) {
+                    out += ",\"detail\":";
+                    append_json_string(out, event.detail);
+                }
+                out += "}}";
+            }
+
+            // Flush in chunks so huge traces do not need one giant string
+            if (out.size() > (1 << 20)) {
+                file.write(out.data(), out.size());
+                out.clear();
+            }
+        }
+        out += "\n]}\n";
+        file.write(out.data(), out.size());
+        return static_cast<bool>(file);
+    }
+};
+
+// Records the lifetime of the scope as one trace span; free when tracing is off
+class TraceSpan {
+private:
+    TraceRecorder* recorder;
+    const char* name;
+    const char* category;
+    const std::string* panoid;
+    std::string detail;
+    uint64_t start;
+
+public:
+    TraceSpan(TraceRecorder* trace, const char* span_name, const char* span_category,
+        const std::string& span_panoid, std::string span_detail = std::string()) :
+        recorder(trace && trace->enabled() ? trace : nullptr), name(span_name), category(span_category),
+        panoid(&span_panoid), start(0) {
+        if (recorder) {
+            detail = std::move(span_detail);
+            start = recorder->now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (recorder) {
+            recorder->record(name, category, *panoid, std::move(detail), start, recorder->now());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+};
+
+// Outcome of one panorama, written as one JSON line when it finishes
+struct PanoramaResult {
+    std::string panoid;
+    bool success = false;
+    bool skipped = false;
+    bool requeued = false;      // Caught in a tile service outage and scheduled again
+    FailureCode failure = FailureCode::none;
+    bool retryable = false;
+    std::string message;
+    int http_status = 0;
+    int generation = 0;
+    int zoom = 0;
+    int tiles_total = 0;
+    int tiles_fetched = 0;
+    int tiles_retried = 0;
+    int tiles_blank = 0;
+    uint64_t bytes = 0;
+    double detect_ms = 0;
+    double fetch_ms = 0;
+    double stitch_ms = 0;
+    double views_ms = 0;
+    double total_ms = 0;
+    std::vector<std::string> outputs;
+
+    void fail(FailureCode code, bool can_retry, const std::string& reason) {
+        success = false;
+        failure = code;
+        retryable = can_retry;
+        message = reason;
+    }
+
+    std::string to_json() const {
+        auto number = [](double value) {
+            char buffer[32];
+            std::snprintf(buffer, sizeof(buffer), "%.1f", value);
+            return std::string(buffer);
+        };
+
+        std::string out = "{\"panoid\":";
+        append_json_string(out, panoid);
+        out += std::string(",\"status\":\"") +
+            (skipped ? "skipped" : (success ? "ok" : (requeued ? "requeued" : "failed"))) + "\"";
+        if (failure == FailureCode::none) {
+            out += ",\"failure\":null";
+        }
+        else {
+            out += std::string(",\"failure\":\"") + failure_code_name(failure) + "\"";
+        }
+        out += std::string(",\"retryable\":") + (retryable ? "true" : "false");
+        if (!message.empty()) {
+            out += ",\"message\":";
+            append_json_string(out, message);
+        }
+        out += ",\"http_status\":" + std::to_string(http_status) +
+            ",\"generation\":" + std::to_string(generation) + ",\"zoom\":" + std::to_string(zoom) +
+            ",\"tiles\":{\"total\":" + std::to_string(tiles_total) + ",\"fetched\":" + std::to_string(tiles_fetched) +
+            ",\"failed\":" + std::to_string(tiles_total - tiles_fetched - tiles_blank) + ",\"retried\":" + std::to_string(tiles_retried) +
+            ",\"blank\":" + std::to_string(tiles_blank) + "},\"bytes\":" + std::to_string(bytes) +
+            ",\"timings_ms\":{\"detect\":" + number(detect_ms) + ",\"fetch\":" + number(fetch_ms) +
+            ",\"stitch\":" + number(stitch_ms) + ",\"views\":" + number(views_ms) + ",\"total\":" + number(total_ms) +
+            "},\"outputs\":[";
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            if (i > 0) {
+                out += ',';
+            }
+            append_json_string(out, outputs[i]);
+        }
+        out += "]}";
+        return out;
+    }
+};
+
+// Appends one JSON line per finished panorama; each line is flushed so the stream can be tailed
+class ResultWriter {
+private:
+    std::ofstream file;
+    std::mutex mutex;
+
+public:
+    explicit ResultWriter(const std::string& path) : file(path, std::ios::binary | std::ios::app) {}
+
+    bool is_open() const { return file.is_open(); }
+
+    void write(const PanoramaResult& result) {
+        std::string line = result.to_json();
+        line += '\n';
+        std::lock_guard<std::mutex> lock(mutex);
+        file.write(line.data(), line.size());
+        file.flush();
+    }
+};
+
+// Write-behind stage that encodes views and writes them to disk off the panorama path
+class ViewWriter {
+public:
+    // Tracks the views of one panorama; sealed once all of them have been submitted
+    class Group {
+    private:
+        std::atomic<int> remaining{ 1 };    // The extra count is released by seal()
+        std::atomic<int> failures{ 0 };
+        std::promise<int> written;
+
+        void release() {
+            if (--remaining == 0) {
+                written.set_value(failures);
+            }
+        }
+
+        friend class ViewWriter;
+    };
+
+private:
+    struct WriteJob {
+        cv::Mat image;
+        std::string path;
+        std::string panoid;
+        int view;
+        std::shared_ptr<Group> group;
+    };
+
+    struct EncodedView {
+        std::vector<uchar> data;
+        std::string path;
+        std::string panoid;
+        int view = 0;
+        bool ok = false;
+        std::shared_ptr<Group> group;
+    };
+
+    // Upper bound on views encoded and submitted together by one worker
+    static constexpr size_t max_batch = 16;
+
+    std::vector<std::thread> workers;
+    size_t worker_count;
+    std::queue<WriteJob> jobs;
+    std::mutex queue_mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::condition_variable idle;
+    size_t capacity;
+    size_t pending;
+    bool stop;
+    std::vector<int> encode_params;
+    std::shared_ptr<Logger> logger;
+    std::shared_ptr<ShardWriter> shard_writer;
+    std::shared_ptr<Metrics> metrics;
+    std::shared_ptr<TraceRecorder> tracer;
+    std::atomic<int> write_failures;
+#ifdef USE_IO_URING
+    // Buffers of writes a failed ring could not reap; the kernel may still read them
+    std::mutex stranded_mutex;
+    std::vector<std::vector<uchar>> stranded_buffers;
+#endif
+
+    void encode_batch(std::vector<WriteJob>& batch, std::vector<EncodedView>& encoded) {
+        encoded.resize(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            encoded[i].path = std::move(batch[i].path);
+            encoded[i].panoid = std::move(batch[i].panoid);
+            encoded[i].view = batch[i].view;
+            encoded[i].group = std::move(batch[i].group);
+            encoded[i].data.clear();
+            try {
+                TraceSpan span(tracer.get(), "encode_view", "encode", encoded[i].panoid,
+                    "view " + std::to_string(encoded[i].view));
+                ScopedTimer timer(metrics->encode);
+                encoded[i].ok = cv::imencode(".jpg", batch[i].image, encoded[i].data, encode_params);
+            }
+            catch (const std::exception& e) {
+                logger->log(LogLevel::error, "Error encoding " + encoded[i].path + ": " + e.what());
+                encoded[i].ok = false;
+            }
+            batch[i].image.release();
+        }
+    }
+
+#ifdef USE_IO_URING
+    // Finish a short write with blocking calls
+    static bool write_remaining(int fd, const uchar* data, size_t size, size_t offset) {
+        while (offset < size) {
+            ssize_t written = pwrite(fd, data + offset, size - offset, offset);
+            if (written <= 0) {
+                return false;
+            }
+            offset += written;
+        }
+        return true;
+    }
+
+    // Submit the whole batch of writes with a single io_uring_submit. Returns false when the
+    // ring failed; views whose writes were not confirmed are marked failed.
+    bool write_batch_uring(io_uring& ring, std::vector<EncodedView>& encoded) {
+        std::vector<int> fds(encoded.size(), -1);
+        std::vector<size_t> queued;     // Indices in submission order
+
+        for (size_t i = 0; i < encoded.size(); ++i) {
+            if (!encoded[i].ok) {
+                continue;
+            }
+            fds[i] = open(encoded[i].path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            io_uring_sqe* sqe = fds[i] >= 0 ? io_uring_get_sqe(&ring) : nullptr;
+            if (!sqe) {
+                encoded[i].ok = false;
+                continue;
+            }
+            io_uring_prep_write(sqe, fds[i], encoded[i].data.data(),
+                static_cast<unsigned>(encoded[i].data.size()), 0);
+            io_uring_sqe_set_data(sqe, &encoded[i]);
+            queued.push_back(i);
+        }
+
+        // Entries left behind by a short submit would go out with the next batch, so keep
+        // submitting; the kernel consumes them in order
+        bool healthy = true;
+        size_t submitted = 0;
+        while (submitted < queued.size()) {
+            int ret = io_uring_submit(&ring);
+            if (ret == -EINTR) {
+                continue;
+            }
+            if (ret <= 0) {
+                healthy = false;
+                break;
+            }
+            submitted += ret;
+        }
+
+        std::vector<bool> reaped(encoded.size(), false);
+        for (size_t done = 0; done < submitted;) {
+            io_uring_cqe* cqe = nullptr;
+            int ret = io_uring_wait_cqe(&ring, &cqe);
+            if (ret == -EINTR) {
+                continue;
+            }
+            if (ret < 0) {
+                healthy = false;
+                break;
+            }
+            EncodedView* view = static_cast<EncodedView*>(io_uring_cqe_get_data(cqe));
+            size_t index = view - encoded.data();
+            if (cqe->res < 0) {
+                view->ok = false;
+            }
+            else if (static_cast<size_t>(cqe->res) < view->data.size()) {
+                view->ok = write_remaining(fds[index], view->data.data(), view->data.size(), cqe->res);
+            }
+            io_uring_cqe_seen(&ring, cqe);
+            reaped[index] = true;
+            done++;
+        }
+
+        for (size_t n = 0; n < queued.size(); ++n) {
+            size_t index = queued[n];
+            if (reaped[index]) {
+                continue;
+            }
+            encoded[index].ok = false;
+            if (n < submitted) {
+                // Still in flight: moving the vector keeps its buffer where the kernel expects it
+                std::lock_guard<std::mutex> lock(stranded_mutex);
+                stranded_buffers.push_back(std::move(encoded[index].data));
+            }
+        }
+
+        // The kernel holds its own file references, so closing is safe even for stranded writes
+        for (int fd : fds) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        return healthy;
+    }
+#endif
+
+    void write_batch(std::vector<EncodedView>& encoded) {
+        for (auto& view : encoded) {
+            if (!view.ok) {
+                continue;
+            }
+            if (shard_writer && !view.panoid.empty()) {
+                view.ok = shard_writer->append(view.panoid, view.view, view.path, view.data);
+                continue;
+            }
+            std::ofstream file(view.path, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(view.data.data()), view.data.size());
+            view.ok = static_cast<bool>(file);
+        }
+    }
+
+    void worker_loop() {
+#ifdef USE_IO_URING
+        io_uring ring;
+        bool ring_ready = io_uring_queue_init(max_batch, &ring, 0) == 0;
+#endif
+        std::vector<WriteJob> batch;
+        std::vector<EncodedView> encoded;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                not_empty.wait(lock, [this] { return stop || !jobs.empty(); });
+                if (stop && jobs.empty()) {
+                    break;
+                }
+
+                // Spread a short queue over all workers so views encode in parallel,
+                // and batch up when a backlog builds
+                size_t take = std::max<size_t>(1, std::min(max_batch, jobs.size() / worker_count));
+                while (!jobs.empty() && batch.size() < take) {
+                    batch.push_back(std::move(jobs.front()));
+                    jobs.pop();
+                }
+            }
+            not_full.notify_all();
+
+            encode_batch(batch, encoded);
+            auto write_start = std::chrono::steady_clock::now();
+            {
+                TraceSpan span(tracer.get(), "write_views", "write", encoded.front().panoid,
+                    std::to_string(encoded.size()) + " views");
+#ifdef USE_IO_URING
+                if (ring_ready && !shard_writer) {
+                    if (!write_batch_uring(ring, encoded)) {
+                        // Never exited: that would cancel stranded writes asynchronously
+                        ring_ready = false;
+                        logger->log(LogLevel::error, "io_uring failed; falling back to standard file writes");
+                    }
+                }
+                else {
+                    write_batch(encoded);
+                }
+#else
+                write_batch(encoded);
+#endif
+            }
+
+            // Writes are submitted per batch; attribute an equal share to each view
+            uint64_t write_micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - write_start).count();
+            for (size_t i = 0; i < encoded.size(); ++i) {
+                metrics->write.record(write_micros / encoded.size());
+            }
+
+            for (auto& view : encoded) {
+                if (view.ok) {
+                    metrics->views_written++;
+                }
+                else {
+                    write_failures++;
+                    logger->log(LogLevel::error, "Failed to write view: " + view.path);
+                }
+                if (view.group) {
+                    if (!view.ok) {
+                        view.group->failures++;
                     }
-                    task();
+                    view.group->release();
+                    view.group.reset();
                 }
-                });
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                pending -= batch.size();
+            }
+            idle.notify_all();
+            batch.clear();
         }
-    }
 
-    template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type> {
-        using return_type = typename std::result_of<F(Args...)>::type;
+#ifdef USE_IO_URING
+        if (ring_ready) {
+            io_uring_queue_exit(&ring);
+        }
+#endif
+    }
 
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+public:
+    // With a shard writer, jobs tagged with a PanoID go into the shards and their paths are
+    // used as tar member suffixes; untagged jobs are always written as files
+    ViewWriter(size_t threads, size_t queue_capacity, int jpeg_quality, std::shared_ptr<Logger> log,
+        std::shared_ptr<Metrics> stats, std::shared_ptr<TraceRecorder> trace,
+        std::shared_ptr<ShardWriter> shards = nullptr) :
+        worker_count(std::max<size_t>(1, threads)), capacity(std::max<size_t>(1, queue_capacity)),
+        pending(0), stop(false),
+        encode_params({ cv::IMWRITE_JPEG_QUALITY, jpeg_quality }),
+        logger(std::move(log)), shard_writer(std::move(shards)), metrics(std::move(stats)),
+        tracer(std::move(trace)), write_failures(0) {
+        workers.reserve(worker_count);
+        for (size_t i = 0; i < worker_count; ++i) {
+            workers.emplace_back([this] { worker_loop(); });
+        }
+    }
 
-        std::future<return_type> result = task->get_future();
+    // Hand a view over for encoding; blocks only while the queue is full
+    void submit(cv::Mat image, std::string path, std::string panoid = "", int view = 0,
+        std::shared_ptr<Group> group = nullptr) {
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
+            not_full.wait(lock, [this] { return stop || jobs.size() < capacity; });
             if (stop) {
-                throw std::runtime_error("enqueue on stopped ThreadPool");
+                throw std::runtime_error("submit on stopped ViewWriter");
             }
-            tasks.emplace([task]() { (*task)(); });
+            if (group) {
+                group->remaining++;
+            }
+            jobs.push({ std::move(image), std::move(path), std::move(panoid), view, std::move(group) });
+            pending++;
         }
-        condition.notify_one();
-        return result;
+        not_empty.notify_one();
     }
 
-    ~ThreadPool() {
+    // Close a group to further views; the future yields how many of its views failed once
+    // every one of them has been encoded and written
+    static std::future<int> seal(const std::shared_ptr<Group>& group) {
+        std::future<int> written = group->written.get_future();
+        group->release();
+        return written;
+    }
+
+    // Wait until every submitted view has been written; shards stay open for further views
+    void flush() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            idle.wait(lock, [this] { return pending == 0; });
+        }
+        if (shard_writer) {
+            shard_writer->flush();
+        }
+    }
+
+    // Flush and finalize the current shard at shutdown
+    void close() {
+        flush();
+        if (shard_writer) {
+            shard_writer->close();
+        }
+    }
+
+    int failure_count() const { return write_failures; }
+
+    // Whether earlier runs already wrote all views of the panorama into the shards
+    bool in_shards(const std::string& panoid, int views) const {
+        return shard_writer && shard_writer->contains(panoid, views);
+    }
+
+    size_t queue_depth() {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return jobs.size();
+    }
+
+    size_t queue_capacity() const { return capacity; }
+
+    ~ViewWriter() {
         {
             std::unique_lock<std::mutex> lock(queue_mutex);
             stop = true;
         }
-        condition.notify_all();
+        not_empty.notify_all();
+        not_full.notify_all();
         for (std::thread& worker : workers) {
             worker.join();
         }
     }
 };
 
-// Progress bar class to display and update download progress
-class ProgressBar {
+// Collapses concurrent calls with the same key into one execution whose result all callers share
+template<typename Value>
+class SingleFlight {
 private:
-    int total;
-    int console_width;
-    std::mutex display_mutex;
-    bool visible;
+    std::mutex flight_mutex;
+    std::unordered_map<std::string, std::shared_future<Value>> in_flight;
 
-    // Get console width for appropriate formatting
-    int get_console_width() {
-#ifdef _WIN32
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-        return csbi.srWindow.Right - csbi.srWindow.Left + 1;
-#else
-        struct winsize w;
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-        return w.ws_col;
-#endif
-        return 80; // Default fallback width
+public:
+    template<class F>
+    Value run(const std::string& key, F&& fn) {
+        std::promise<Value> promise;
+        std::shared_future<Value> result;
+        {
+            std::unique_lock<std::mutex> lock(flight_mutex);
+            auto it = in_flight.find(key);
+            if (it != in_flight.end()) {
+                // Someone is already fetching this; wait for their result
+                result = it->second;
+                lock.unlock();
+                return result.get();
+            }
+            result = promise.get_future().share();
+            in_flight.emplace(key, result);
+        }
+
+        try {
+            promise.set_value(fn());
+        }
+        catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(flight_mutex);
+            in_flight.erase(key);
+        }
+        return result.get();
     }
+};
+
+// Pull-based source of work items; returns false once exhausted
+using WorkSource = std::function<bool(std::string&)>;
+
+// Adapt an in-memory list to a work source
+inline WorkSource make_list_source(std::vector<std::string> items) {
+    auto list = std::make_shared<std::vector<std::string>>(std::move(items));
+    auto next = std::make_shared<size_t>(0);
+    return [list, next](std::string& item) {
+        if (*next >= list->size()) {
+            return false;
+        }
+        item = (*list)[(*next)++];
+        return true;
+    };
+}
+
+// Called with the index of a work item (in source order) once its outcome is known
+using ResultCallback = std::function<void(size_t, bool)>;
+
+// Progress display fed by atomic counters and redrawn by one renderer thread at a fixed rate.
+// Workers only increment counters; on a terminal the bar is redrawn in place at the bottom,
+// otherwise a plain progress line is printed periodically so logs and pipes stay readable.
+class ProgressBar {
+private:
+    std::atomic<int> total;
+    std::atomic<int> completed;
+    std::atomic<int> successful;
+    std::atomic<int> failed;
+    std::shared_ptr<Metrics> metrics;
 
-    // Move cursor to the bottom of the console
-    void move_cursor_to_bottom() {
+    bool interactive;
+    bool visible;
+    std::chrono::milliseconds interval;
+    std::chrono::steady_clock::time_point start_time;
+
+    std::thread renderer;
+    std::mutex render_mutex;
+    std::condition_variable render_condition;
+    bool stopping;
+
+    // Smoothed rates, only touched by the renderer
+    std::chrono::steady_clock::time_point last_sample_time;
+    uint64_t last_tiles;
+    uint64_t last_bytes;
+    int last_completed;
+    double tile_rate;
+    double byte_rate;
+    double panorama_rate;
+
+    static bool stdout_is_terminal() {
 #ifdef _WIN32
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-        COORD coord;
-        coord.X = 0;
-        coord.Y = csbi.srWindow.Bottom;
-        SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), coord);
+        return _isatty(_fileno(stdout)) != 0;
 #else
-        // Move to bottom of visible screen
-        std::cout << "\033[" << get_terminal_height() - 1 << ";0H";
+        return isatty(STDOUT_FILENO) != 0;
 #endif
     }
 
-    // Get terminal height
-    int get_terminal_height() {
+    // Console width and height in one query, with fallbacks when it cannot be read
+    static std::pair<int, int> console_size() {
 #ifdef _WIN32
         CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-        return csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+        if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi)) {
+            return { csbi.srWindow.Right - csbi.srWindow.Left + 1, csbi.srWindow.Bottom - csbi.srWindow.Top + 1 };
+        }
 #else
         struct winsize w;
-        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-        return w.ws_row;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) == 0 && w.ws_col > 0 && w.ws_row > 0) {
+            return { w.ws_col, w.ws_row };
+        }
 #endif
-        return 24; // Default fallback height
+        return { 80, 24 };
     }
 
-    // Clear the current line
-    void clear_line() {
-#ifdef _WIN32
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
-        DWORD written;
-        FillConsoleOutputCharacterA(
-            GetStdHandle(STD_OUTPUT_HANDLE), ' ',
-            csbi.dwSize.X, { 0, csbi.dwCursorPosition.Y },
-            &written
-        );
-        SetConsoleCursorPosition(
-            GetStdHandle(STD_OUTPUT_HANDLE),
-            { 0, csbi.dwCursorPosition.Y }
-        );
-#else
-        std::cout << "\033[2K\r"; // Clear the line and move to the beginning
-#endif
+    static std::string format_duration(double seconds) {
+        if (!(seconds >= 0) || seconds > 359999) {
+            return "--:--";
+        }
+        long total_seconds = static_cast<long>(seconds + 0.5);
+        char buffer[32];
+        if (total_seconds >= 3600) {
+            std::snprintf(buffer, sizeof(buffer), "%ld:%02ld:%02ld",
+                total_seconds / 3600, (total_seconds / 60) % 60, total_seconds % 60);
+        }
+        else {
+            std::snprintf(buffer, sizeof(buffer), "%02ld:%02ld", total_seconds / 60, total_seconds % 60);
+        }
+        return buffer;
     }
 
-public:
-    ProgressBar(int total_count) : total(total_count), visible(false) {
-        console_width = get_console_width();
+    // Fold the counters since the last sample into exponentially smoothed rates
+    void sample_rates() {
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - last_sample_time).count();
+        if (elapsed <= 0) {
+            return;
+        }
+
+        uint64_t tiles = metrics ? metrics->tile_decode.count() : 0;
+        uint64_t bytes = metrics ? metrics->bytes_downloaded.load(std::memory_order_relaxed) : 0;
+        int done = completed.load(std::memory_order_relaxed);
+
+        const double alpha = 0.3;
+        bool first = last_completed < 0;
+        double tiles_now = (tiles - last_tiles) / elapsed;
+        double bytes_now = (bytes - last_bytes) / elapsed;
+        tile_rate = first ? tiles_now : alpha * tiles_now + (1 - alpha) * tile_rate;
+        byte_rate = first ? bytes_now : alpha * bytes_now + (1 - alpha) * byte_rate;
+
+        // Panoramas finish in bursts, so their rate is averaged over the whole run
+        double run_seconds = std::chrono::duration<double>(now - start_time).count();
+        panorama_rate = run_seconds > 0 ? done / run_seconds : 0;
+
+        last_sample_time = now;
+        last_tiles = tiles;
+        last_bytes = bytes;
+        last_completed = done;
     }
 
-    ~ProgressBar() {
-        // Ensure we leave the terminal in a clean state
-        if (visible) {
-            hide();
-        }
+    std::string status_text() const {
+        int all = total.load(std::memory_order_relaxed);
+        int done = completed.load(std::memory_order_relaxed);
+        double eta = panorama_rate > 0 && all >= done ? (all - done) / panorama_rate : -1;
+
+        char buffer[256];
+        std::snprintf(buffer, sizeof(buffer),
+            "%d/%d (%d success, %d failed) | %.0f tiles/s | %.1f MB/s | %.2f pano/s | ETA %s",
+            done, all, successful.load(std::memory_order_relaxed), failed.load(std::memory_order_relaxed),
+            tile_rate, byte_rate / (1024.0 * 1024.0), panorama_rate, format_duration(eta).c_str());
+        return buffer;
     }
 
-    void update(int completed, int successful, int failed) {
-        std::lock_guard<std::mutex> lock(display_mutex);
+    // Build the whole frame in one string so each redraw is a single write
+    void render() {
+        sample_rates();
+        std::string status = status_text();
 
-        // Calculate progress percentage
-        double progress = (total > 0) ? (double)completed / total : 0;
-        int bar_width = std::min(50, console_width - 35); // Reserve space for text
+        if (!interactive) {
+            std::cout << "Progress: " + status + "\n" << std::flush;
+            return;
+        }
 
-        // Save cursor position
-#ifndef _WIN32
-        std::cout << "\033[s"; // Save cursor position
-#endif
+        std::pair<int, int> size = console_size();
+        int all = total.load(std::memory_order_relaxed);
+        double progress = all > 0 ? std::min(1.0, static_cast<double>(completed.load()) / all) : 0;
+        int bar_width = std::max(0, std::min(40, size.first - static_cast<int>(status.size()) - 8));
+        int pos = static_cast<int>(bar_width * progress);
+
+        std::string line;
+        if (bar_width > 0) {
+            line += '[';
+            for (int i = 0; i < bar_width; ++i) {
+                line += i < pos ? '=' : (i == pos ? '>' : ' ');
+            }
+            line += "] ";
+        }
+        line += std::to_string(static_cast<int>(progress * 100.0)) + "% " + status;
+        if (static_cast<int>(line.size()) >= size.first) {
+            line.resize(std::max(0, size.first - 1));
+        }
+
+        // Save the cursor, draw on the bottom line and restore, so log output is not disturbed
+        std::cout << "\033[s\033[" + std::to_string(size.second - 1) + ";0H\033[2K" + line + "\033[u" << std::flush;
+        visible = true;
+    }
 
-        // Move to bottom of console
-        move_cursor_to_bottom();
-        clear_line();
+    void clear() {
+        if (!visible) {
+            return;
+        }
+        std::pair<int, int> size = console_size();
+        std::cout << "\033[s\033[" + std::to_string(size.second - 1) + ";0H\033[2K\033[u" << std::flush;
+        visible = false;
+    }
 
-        // Format progress bar
-        std::cout << "[";
-        int pos = bar_width * progress;
-        for (int i = 0; i < bar_width; ++i) {
-            if (i < pos) std::cout << "=";
-            else if (i == pos) std::cout << ">";
-            else std::cout << " ";
+public:
+    ProgressBar(int total_count, std::shared_ptr<Metrics> metrics_source = nullptr) :
+        total(total_count), completed(0), successful(0), failed(0), metrics(std::move(metrics_source)),
+        interactive(stdout_is_terminal()), visible(false), stopping(false),
+        last_tiles(0), last_bytes(0), last_completed(-1), tile_rate(0), byte_rate(0), panorama_rate(0) {
+#if defined(_WIN32) && defined(ENABLE_VIRTUAL_TERMINAL_PROCESSING)
+        // Windows 10+ consoles understand the ANSI sequences once VT processing is on
+        HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        if (interactive && GetConsoleMode(console, &mode)) {
+            SetConsoleMode(console, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
         }
+#endif
+        interval = interactive ? std::chrono::milliseconds(250) : std::chrono::milliseconds(10000);
+        start_time = std::chrono::steady_clock::now();
+        last_sample_time = start_time;
+    }
 
-        // Show progress stats
-        std::cout << "] " << static_cast<int>(progress * 100.0) << "% ";
-        std::cout << completed << "/" << total << " (";
-        std::cout << successful << " success, " << failed << " failed)";
+    ~ProgressBar() {
+        // Ensure we leave the terminal in a clean state
+        stop();
+    }
 
-        std::cout.flush();
-        visible = true;
+    ProgressBar(const ProgressBar&) = delete;
+    ProgressBar& operator=(const ProgressBar&) = delete;
 
-        // Restore cursor position in Unix-like systems
-#ifndef _WIN32
-        std::cout << "\033[u"; // Restore cursor position
-#endif
+    bool is_interactive() const { return interactive; }
+
+    // Start redrawing at a fixed rate until stopped
+    void start() {
+        if (renderer.joinable()) {
+            return;
+        }
+        stopping = false;
+        renderer = std::thread([this] {
+            std::unique_lock<std::mutex> lock(render_mutex);
+            while (!render_condition.wait_for(lock, interval, [this] { return stopping; })) {
+                render();
+            }
+            });
     }
 
-    void hide() {
-        if (!visible) return;
+    // Stop the renderer; non-interactive output gets one final line, the bar is cleared
+    void stop() {
+        if (!renderer.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(render_mutex);
+            stopping = true;
+        }
+        render_condition.notify_all();
+        renderer.join();
 
-        std::lock_guard<std::mutex> lock(display_mutex);
-#ifndef _WIN32
-        std::cout << "\033[s"; // Save cursor position
-#endif
+        if (interactive) {
+            clear();
+        }
+        else {
+            render();
+        }
+    }
 
-        move_cursor_to_bottom();
-        clear_line();
+    // The total grows while streaming input is still being read
+    void set_total(int total_count) {
+        total.store(total_count, std::memory_order_relaxed);
+    }
 
-#ifndef _WIN32
-        std::cout << "\033[u"; // Restore cursor position
-#endif
-        std::cout.flush();
-        visible = false;
+    void record_result(bool success) {
+        (success ? successful : failed).fetch_add(1, std::memory_order_relaxed);
+        completed.fetch_add(1, std::memory_order_relaxed);
     }
 };
 
 // Main Street View Downloader class
 class StreetViewDownloader {
+    // The microbenchmarks drive the CPU stages directly; the library client uses the in-memory paths
+    friend class DownloaderBenchmark;
+    friend class StreetViewClient;
+
 private:
     // Configuration
     int retry_count;
@@ -561,6 +3356,18 @@ private:
     bool create_directional_views;
     bool clean_csv_output;
     std::string csv_output_path;
+    int jpeg_quality;
+    int encode_thread_count;
+    int decode_thread_count;
+    int stitch_thread_count;
+    double panorama_timeout;
+    int max_failed_tiles;
+    bool shard_output;
+    int shard_size_mb;
+    bool export_pyramid;
+
+    // Base URL of the tile service; point it at a local mock server for load tests
+    std::string tile_host;
 
     // Threading resources
     std::shared_ptr<ThreadPool> thread_pool;
@@ -570,6 +3377,50 @@ private:
     std::atomic<int> download_progress;
     std::atomic<int> active_threads;
     std::shared_ptr<ProgressBar> progress_bar;
+    std::shared_ptr<ViewWriter> view_writer;
+
+    // Progress bar and failed PanoID listing; off for library clients
+    bool report_progress;
+
+    // Stage latencies and counters, optionally exported as a Prometheus text file
+    std::shared_ptr<Metrics> metrics;
+    std::string metrics_path;
+    int metrics_interval;
+    std::thread metrics_thread;
+    std::mutex metrics_mutex;
+    std::condition_variable metrics_condition;
+    bool metrics_stop;
+
+    // Optional timeline of every stage span, written as Chrome trace JSON
+    std::shared_ptr<TraceRecorder> tracer;
+    std::string trace_path;
+
+    // Pauses all tile requests while the tile service is failing
+    std::shared_ptr<CircuitBreaker> breaker;
+    double breaker_threshold;
+    double breaker_window;
+    double breaker_cooldown;
+
+    // Hedged tile requests: a duplicate is sent once a tile is slower than this percentile of
+    // recent tile latencies (0 = off), using at most hedge_budget percent of tile requests
+    double hedge_percentile;
+    double hedge_budget;
+    static constexpr uint64_t hedge_min_samples = 50;
+    static constexpr uint64_t hedge_min_delay_us = 20000;
+    RecentLatency recent_tile_fetch{ std::chrono::seconds(30) };
+
+    // Panoramas caught in an outage are scheduled again instead of being recorded as failed
+    static constexpr int max_requeues = 3;
+    std::unordered_map<std::string, int> requeue_counts;
+    std::unordered_set<std::string> requeued_panoids;
+
+    // Optional JSONL stream with one record per finished panorama
+    std::shared_ptr<ResultWriter> result_writer;
+    std::string results_path;
+
+    // Pipeline stages after the network fetch: tile decode, then stitch and projection
+    std::shared_ptr<StageExecutor> decode_stage;
+    std::shared_ptr<StageExecutor> stitch_stage;
 
     // CURL setup for HTTP requests
     CURL* curl_handle;
@@ -589,6 +3440,25 @@ private:
 
     // Random generator for jitter
     std::mt19937 random_engine;
+    std::mutex random_lock;
+
+    // View parameters and optional per-PanoID deterministic seeding
+    ViewConfig view_config;
+    bool deterministic_seed;
+    uint64_t seed_base;
+
+    // Blank tile detection shared by all tile downloads
+    TileValidator tile_validator;
+
+    // Concurrent requests for the same panorama or generation probe share one fetch
+    SingleFlight<bool> panorama_flights;
+    SingleFlight<std::pair<int, std::string>> generation_flights;
+
+    // URL of one tile on the configured tile host
+    std::string tile_url(const std::string& panoid, int zoom, int x, int y) const {
+        return tile_host + "/v1/tile?cb_client=apiv3&panoid=" + panoid + "&output=tile&zoom=" +
+            std::to_string(zoom) + "&x=" + std::to_string(x) + "&y=" + std::to_string(y);
+    }
 
     // Method to initialize CURL with common settings
     CURL* init_curl() {
@@ -600,19 +3470,21 @@ private:
         return handle;
     }
 
-    // Check if a tile is valid (not completely black)
-    bool is_valid_tile(const cv::Mat& img) {
-        if (img.empty() || img.cols < 10 || img.rows < 10) {
-            return false;
-        }
-
-        // Convert to grayscale for faster processing
-        cv::Mat gray;
-        cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    // Check if a downloaded tile payload is valid (not completely black)
+    bool is_valid_tile(const std::string& payload) {
+        ScopedTimer timer(metrics->tile_validate);
+        return tile_validator.is_valid(payload);
+    }
 
-        // Check if the image is completely black (all values are 0)
-        cv::Scalar mean = cv::mean(gray);
-        return mean[0] > 0.1; // Threshold slightly above 0 to account for compression artifacts
+    // Decode a tile payload without copying it into an intermediate buffer
+    cv::Mat decode_tile(const std::string& payload) {
+        ScopedTimer timer(metrics->tile_decode);
+        cv::Mat raw(1, static_cast<int>(payload.size()), CV_8UC1, const_cast<char*>(payload.data()));
+        cv::Mat img = cv::imdecode(raw, cv::IMREAD_COLOR);
+        if (img.cols < 10 || img.rows < 10) {
+            return cv::Mat();
+        }
+        return img;
     }
 
     // Get cached generation if available
@@ -637,9 +3509,70 @@ private:
         failed_panoids.insert(panoid);
     }
 
-    // Detect Street View panorama generation
-    std::pair<int, std::string> detect_generation(const std::string& panoid) {
-        logger->log("Detecting generation for " + panoid);
+    // Schedule a panorama again after an outage; false once it has used up its re-queues
+    bool mark_requeued(const std::string& panoid) {
+        std::lock_guard<std::mutex> lock(failed_panoids_mutex);
+        int& count = requeue_counts[panoid];
+        if (count >= max_requeues) {
+            return false;
+        }
+        count++;
+        requeued_panoids.insert(panoid);
+        return true;
+    }
+
+    bool take_requeued(const std::string& panoid) {
+        std::lock_guard<std::mutex> lock(failed_panoids_mutex);
+        return requeued_panoids.erase(panoid) > 0;
+    }
+
+    // Detect Street View panorama generation; probe errors are counted into stats when given
+    // With a token, the probes count against the panorama deadline like its tile requests
+    std::pair<int, std::string> detect_generation(const std::string& panoid, TileFetchStats* stats = nullptr,
+        CancellationToken* token = nullptr) {
+        TraceSpan span(tracer.get(), "detect_generation", "network", panoid);
+        logger->log(LogLevel::debug, "Detecting generation for " + panoid);
+
+        // Probes go through the circuit breaker like tile requests. A missing probe tile is
+        // expected; throttling and transport errors make the result unreliable.
+        auto perform_probe = [this, stats, token](CURL* handle) {
+            if (token) {
+                if (token->is_cancelled()) {
+                    return CURLE_ABORTED_BY_CALLBACK;
+                }
+                long remaining = token->remaining_ms();
+                if (remaining >= 0) {
+                    curl_easy_setopt(handle, CURLOPT_TIMEOUT_MS, std::min(remaining, timeout_value * 1000L));
+                }
+            }
+
+            bool probe = false;
+            if (!breaker->acquire(token, probe)) {
+                return CURLE_ABORTED_BY_CALLBACK;
+            }
+            CURLcode res = curl_easy_perform(handle);
+            if (res == CURLE_ABORTED_BY_CALLBACK) {
+                if (probe) {
+                    breaker->abandon_probe();
+                }
+                return res;
+            }
+            long response_code = 0;
+            if (res == CURLE_OK) {
+                curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code);
+            }
+            breaker->record(res == CURLE_OK && response_code != 429 && response_code < 500, probe);
+
+            if (stats) {
+                if (res != CURLE_OK) {
+                    stats->transport_errors++;
+                }
+                else if (response_code != 200) {
+                    stats->last_http_status = static_cast<int>(response_code);
+                }
+            }
+            return res;
+        };
 
         // Generation test patterns - specific tile coordinates and zoom levels to test
         struct TestPattern {
@@ -650,56 +3583,58 @@ private:
 
         std::vector<TestPattern> tests = {
             {4, 4, {{15, 7}, {14, 6}}},  // Gen 4 (zoom 4, 16x8)
-            {3, 4, {{12, 6}, {11, 5}}},  // Gen 3 (zoom 4, 13x7)
+            {3, 4, {{12, 6}, {11, 6}}},  // Gen 3 (zoom 4, 13x7); only row 6 tells it from gen 2
             {2, 4, {{12, 5}, {10, 4}}},  // Gen 2 (zoom 4, 13x6)
             {1, 3, {{7, 3}, {6, 2}}}     // Gen 1 (zoom 3, 8x4)
         };
 
         CURL* curl = init_curl();
         if (!curl) {
-            logger->log("Failed to initialize CURL for generation detection");
+            logger->log(LogLevel::error, "Failed to initialize CURL for generation detection");
             return { 0, "Unknown Generation" };
         }
+        if (token) {
+            curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+            curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, TransferCancelCallback);
+            curl_easy_setopt(curl, CURLOPT_XFERINFODATA, token);
+        }
 
         for (const auto& test : tests) {
             int gen = test.gen;
             int zoom = test.zoom;
 
             for (const auto& coords : test.tests) {
+                if (token && token->was_cancelled()) {
+                    curl_easy_cleanup(curl);
+                    return { 0, "Unknown Generation" };
+                }
                 int x = coords.first;
                 int y = coords.second;
 
-                std::string url = "https://streetviewpixels-pa.googleapis.com/v1/tile?cb_client=apiv3&panoid=" +
-                    panoid + "&output=tile&zoom=" + std::to_string(zoom) +
-                    "&x=" + std::to_string(x) + "&y=" + std::to_string(y);
+                std::string url = tile_url(panoid, zoom, x, y);
 
                 std::string response_data;
                 curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
                 curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
 
-                CURLcode res = curl_easy_perform(curl);
+                CURLcode res = perform_probe(curl);
 
                 if (res == CURLE_OK) {
                     long response_code;
                     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
 
-                    if (response_code == 200 && !response_data.empty()) {
-                        // Try to convert to an image
-                        std::vector<uchar> buffer(response_data.begin(), response_data.end());
-                        cv::Mat img = cv::imdecode(buffer, cv::IMREAD_COLOR);
-
-                        if (!img.empty() && is_valid_tile(img)) {
-                            std::string description;
-                            switch (gen) {
-                            case 4: description = "Generation 4 (Zoom 4, 16x8)"; break;
-                            case 3: description = "Generation 3 (Zoom 4, 13x7)"; break;
-                            case 2: description = "Generation 2 (Zoom 4, 13x6)"; break;
-                            case 1: description = "Generation 1 (Zoom 3, 8x4)"; break;
-                            }
-
-                            curl_easy_cleanup(curl);
-                            return { gen, description };
+                    // A probe only needs to know the tile exists and is not blank
+                    if (response_code == 200 && is_valid_tile(response_data)) {
+                        std::string description;
+                        switch (gen) {
+                        case 4: description = "Generation 4 (Zoom 4, 16x8)"; break;
+                        case 3: description = "Generation 3 (Zoom 4, 13x7)"; break;
+                        case 2: description = "Generation 2 (Zoom 4, 13x6)"; break;
+                        case 1: description = "Generation 1 (Zoom 3, 8x4)"; break;
                         }
+
+                        curl_easy_cleanup(curl);
+                        return { gen, description };
                     }
                 }
             }
@@ -707,57 +3642,50 @@ private:
 
         // Fallback tests for central tiles
         try {
+            if (token && token->was_cancelled()) {
+                curl_easy_cleanup(curl);
+                return { 0, "Unknown Generation" };
+            }
+
             // Try zoom 4 first (most common)
-            std::string url = "https://streetviewpixels-pa.googleapis.com/v1/tile?cb_client=apiv3&panoid=" +
-                panoid + "&output=tile&zoom=4&x=8&y=4";
+            std::string url = tile_url(panoid, 4, 8, 4);
 
             std::string response_data;
             curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
             curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
 
-            CURLcode res = curl_easy_perform(curl);
+            CURLcode res = perform_probe(curl);
 
             if (res == CURLE_OK) {
                 long response_code;
                 curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
 
-                if (response_code == 200 && !response_data.empty()) {
-                    std::vector<uchar> buffer(response_data.begin(), response_data.end());
-                    cv::Mat img = cv::imdecode(buffer, cv::IMREAD_COLOR);
-
-                    if (!img.empty() && is_valid_tile(img)) {
-                        curl_easy_cleanup(curl);
-                        return { 4, "Generation 4 (Zoom 4, 16x8) - Default" };
-                    }
+                if (response_code == 200 && is_valid_tile(response_data)) {
+                    curl_easy_cleanup(curl);
+                    return { 4, "Generation 4 (Zoom 4, 16x8) - Default" };
                 }
             }
 
             // Try zoom 3 as a last resort
-            url = "https://streetviewpixels-pa.googleapis.com/v1/tile?cb_client=apiv3&panoid=" +
-                panoid + "&output=tile&zoom=3&x=4&y=2";
+            url = tile_url(panoid, 3, 4, 2);
 
             response_data.clear();
             curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
 
-            res = curl_easy_perform(curl);
+            res = perform_probe(curl);
 
             if (res == CURLE_OK) {
                 long response_code;
                 curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
 
-                if (response_code == 200 && !response_data.empty()) {
-                    std::vector<uchar> buffer(response_data.begin(), response_data.end());
-                    cv::Mat img = cv::imdecode(buffer, cv::IMREAD_COLOR);
-
-                    if (!img.empty() && is_valid_tile(img)) {
-                        curl_easy_cleanup(curl);
-                        return { 1, "Generation 1 (Zoom 3, 8x4) - Default" };
-                    }
+                if (response_code == 200 && is_valid_tile(response_data)) {
+                    curl_easy_cleanup(curl);
+                    return { 1, "Generation 1 (Zoom 3, 8x4) - Default" };
                 }
             }
         }
         catch (const std::exception& e) {
-            logger->log("Exception in fallback detection: " + std::string(e.what()));
+            logger->log(LogLevel::warning, "Exception in fallback detection: " + std::string(e.what()));
         }
 
         curl_easy_cleanup(curl);
@@ -782,89 +3710,380 @@ private:
         return configs.at(4);
     }
 
-    // Download a single tile with retry logic
-    Tile download_tile(int x, int y, const std::string& panoid, int zoom) {
-        Tile tile(x, y);
-        std::string url = "https://streetviewpixels-pa.googleapis.com/v1/tile?cb_client=apiv3&panoid=" +
-            panoid + "&output=tile&zoom=" + std::to_string(zoom) +
-            "&x=" + std::to_string(x) + "&y=" + std::to_string(y);
+    // Fetch the compressed bytes of one tile; returns an empty string on failure.
+    // Decoding happens on the decode stage so network workers go straight back to fetching.
+    // A 404 or a blank tile will not change on retry, so those set permanent and stop early.
+    std::string fetch_tile_payload(int x, int y, const std::string& panoid, int zoom,
+        CancellationToken& token, TileFetchStats& stats, bool& permanent) {
+        permanent = false;
+        if (token.is_cancelled()) {
+            return std::string();
+        }
+
+        std::string url = tile_url(panoid, zoom, x, y);
 
         CURL* curl = init_curl();
         if (!curl) {
-            logger->log("Failed to initialize CURL for tile download");
-            return tile;
+            logger->log(LogLevel::error, "Failed to initialize CURL for tile download");
+            return std::string();
+        }
+
+        // Let a cancelled panorama abort its transfers mid-flight
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, TransferCancelCallback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &token);
+
+        // Try multiple times with exponential backoff
+        for (int attempt = 0; attempt < retry_count && !permanent; ++attempt) {
+            if (attempt > 0) {
+                // Exponential backoff with jitter
+                std::uniform_real_distribution<double> dist(0.0, 1.0);
+                double jitter;
+                {
+                    std::lock_guard<std::mutex> lock(random_lock);
+                    jitter = dist(random_engine);
+                }
+                double backoff_time = std::min(std::pow(2.0, attempt) + jitter, 10.0);
+                if (!token.sleep_for(std::chrono::duration<double>(backoff_time))) {
+                    break;
+                }
+            }
+
+            // Never wait on a transfer past the panorama deadline
+            long remaining = token.remaining_ms();
+            if (remaining >= 0) {
+                curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, std::min(remaining, timeout_value * 1000L));
+            }
+
+            // Wait here while the tile service is failing; one request at a time probes for recovery
+            bool probe = false;
+            if (!breaker->acquire(&token, probe)) {
+                break;
+            }
+
+            std::string response_data;
+            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
+
+            CURL* winner = curl;
+            CURL* hedge = nullptr;
+            auto request_start = std::chrono::steady_clock::now();
+            CURLcode res = perform_tile_request(curl, response_data, winner, hedge);
+            metrics->tile_requests++;
+            if (attempt > 0) {
+                metrics->tile_retries++;
+                if (attempt == 1) {
+                    stats.retried_tiles++;
+                }
+            }
+
+            // A winning hedge only timed its own part of the request, so use the full wait instead
+            long response_code = 0;
+            if (res == CURLE_OK) {
+                record_transfer_metrics(winner, winner == curl ? 0 :
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - request_start).count());
+                curl_easy_getinfo(winner, CURLINFO_RESPONSE_CODE, &response_code);
+            }
+            if (hedge) {
+                curl_easy_cleanup(hedge);
+            }
+
+            if (res == CURLE_ABORTED_BY_CALLBACK) {
+                if (probe) {
+                    breaker->abandon_probe();
+                }
+                break;
+            }
+
+            if (res != CURLE_OK) {
+                metrics->transfer_errors++;
+                stats.transport_errors++;
+                breaker->record(false, probe);
+            }
+            else {
+                metrics->count_response(response_code);
+                breaker->record(response_code != 429 && response_code < 500, probe);
+
+                // Blank tiles are rejected from the compressed bytes before decoding
+                if (response_code == 200) {
+                    if (is_valid_tile(response_data)) {
+                        stats.bytes += response_data.size();
+                        curl_easy_cleanup(curl);
+                        return response_data;
+                    }
+                    stats.blank_tiles++;
+                    permanent = true;
+                }
+                else {
+                    stats.last_http_status = static_cast<int>(response_code);
+                    permanent = response_code == 404;
+                }
+            }
+        }
+
+        if (!token.is_cancelled()) {
+            logger->log(LogLevel::warning, "Failed to download tile at (" + std::to_string(x) + ", " +
+                std::to_string(y) + ") for " + panoid);
+        }
+
+        curl_easy_cleanup(curl);
+        return std::string();
+    }
+
+    // Latency after which a still-running tile request is hedged, or zero when hedging is off
+    // or too few tiles have been timed recently for the percentile to mean anything
+    std::chrono::microseconds hedge_delay() {
+        if (hedge_percentile <= 0 || recent_tile_fetch.count() < hedge_min_samples) {
+            return std::chrono::microseconds(0);
         }
+        uint64_t threshold = recent_tile_fetch.quantile(std::min(hedge_percentile, 99.9) / 100.0);
+        return std::chrono::microseconds(std::max(threshold, hedge_min_delay_us));
+    }
+
+    // Hedges may use at most hedge_budget percent of tile requests, plus a small burst allowance
+    bool take_hedge_budget() {
+        uint64_t allowed = static_cast<uint64_t>(metrics->tile_requests.load() * hedge_budget / 100.0) + 10;
+        uint64_t sent = metrics->hedges_sent.load();
+        while (sent < allowed) {
+            if (metrics->hedges_sent.compare_exchange_weak(sent, sent + 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Run one tile transfer. With hedging on, a request still running after hedge_delay() gets a
+    // duplicate on a second handle while the circuit breaker is closed: the first response that
+    // is not a transport error, 429 or 5xx wins and the other transfer is dropped. winner is set
+    // to the handle holding the result; a non-null hedge must be cleaned up by the caller once it
+    // has read the result.
+    CURLcode perform_tile_request(CURL* curl, std::string& response_data, CURL*& winner, CURL*& hedge) {
+        winner = curl;
+        hedge = nullptr;
+
+        std::chrono::microseconds delay = hedge_delay();
+        CURLM* multi = delay.count() > 0 ? curl_multi_init() : nullptr;
+        if (!multi) {
+            return curl_easy_perform(curl);
+        }
+        curl_multi_add_handle(multi, curl);
+
+        auto hedge_at = std::chrono::steady_clock::now() + delay;
+        bool hedge_considered = false;
+        std::string hedge_data;
+        CURLcode result = CURLE_OK;
+        int unfinished = 1;
+        bool decided = false;
+
+        while (!decided && unfinished > 0) {
+            int running = 0;
+            curl_multi_perform(multi, &running);
+
+            int queued = 0;
+            while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+                if (message->msg != CURLMSG_DONE) {
+                    continue;
+                }
+                unfinished--;
+                winner = message->easy_handle;
+                result = message->data.result;
+
+                // A failed transfer or an overloaded answer only decides the outcome when nothing
+                // else is still running
+                long response_code = 0;
+                if (result == CURLE_OK) {
+                    curl_easy_getinfo(winner, CURLINFO_RESPONSE_CODE, &response_code);
+                }
+                if (result == CURLE_OK && response_code != 429 && response_code < 500) {
+                    decided = true;
+                    break;
+                }
+            }
+            if (decided || unfinished == 0) {
+                break;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (!hedge_considered && now >= hedge_at) {
+                hedge_considered = true;
+
+                // A failing tile service gets no extra load beyond what the breaker admits
+                if (!breaker->is_open() && take_hedge_budget()) {
+                    hedge = curl_easy_duphandle(curl);
+                    if (hedge) {
+                        curl_easy_setopt(hedge, CURLOPT_WRITEDATA, &hedge_data);
+                        curl_multi_add_handle(multi, hedge);
+                        unfinished++;
+                    }
+                }
+            }
 
-        // Try multiple times with exponential backoff
-        for (int attempt = 0; attempt < retry_count; ++attempt) {
-            if (attempt > 0) {
-                // Exponential backoff with jitter
-                std::uniform_real_distribution<double> dist(0.0, 1.0);
-                double backoff_time = std::min(std::pow(2.0, attempt) + dist(random_engine), 10.0);
-                std::this_thread::sleep_for(std::chrono::duration<double>(backoff_time));
+            int wait_ms = 100;
+            if (!hedge_considered) {
+                auto until_hedge = std::chrono::duration_cast<std::chrono::milliseconds>(hedge_at - now).count();
+                wait_ms = static_cast<int>(std::max<long long>(1, std::min<long long>(wait_ms, until_hedge)));
             }
+            curl_multi_wait(multi, nullptr, 0, wait_ms, nullptr);
+        }
 
-            std::string response_data;
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
+        // Removing the loser from the multi handle abandons its transfer
+        curl_multi_remove_handle(multi, curl);
+        if (hedge) {
+            curl_multi_remove_handle(multi, hedge);
+        }
+        curl_multi_cleanup(multi);
 
-            CURLcode res = curl_easy_perform(curl);
+        if (hedge && winner == hedge) {
+            response_data.swap(hedge_data);
+            metrics->hedges_won++;
+        }
+        return result;
+    }
 
-            if (res == CURLE_OK) {
-                long response_code;
-                curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response_code);
+    // Split a finished transfer into DNS, connect, TLS and time-to-first-byte phases.
+    // CURL reports cumulative times from the start of the request, in microseconds.
+    // observed_total replaces the transfer's own total time when it is not zero.
+    void record_transfer_metrics(CURL* curl, uint64_t observed_total = 0) {
+        curl_off_t dns = 0, connect = 0, tls = 0, first_byte = 0, total = 0, bytes = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+
+        // Reused connections report zero for the connection phases
+        if (connect > 0) {
+            metrics->dns.record(dns);
+            metrics->connect.record(connect - dns);
+        }
+        if (tls > 0) {
+            metrics->tls.record(tls - connect);
+        }
+        if (first_byte > 0) {
+            metrics->ttfb.record(first_byte - std::max(tls, connect));
+        }
+        uint64_t fetch_micros = observed_total > 0 ? observed_total : static_cast<uint64_t>(total);
+        metrics->tile_fetch.record(fetch_micros);
+        if (hedge_percentile > 0) {
+            recent_tile_fetch.record(fetch_micros);
+        }
+        metrics->bytes_downloaded += bytes;
+    }
 
-                if (response_code == 200 && !response_data.empty()) {
-                    // Convert to OpenCV image
-                    std::vector<uchar> buffer(response_data.begin(), response_data.end());
-                    cv::Mat img = cv::imdecode(buffer, cv::IMREAD_COLOR);
+    // Periodically rewrite the Prometheus text file until stopped
+    void start_metrics_export() {
+        if (metrics_path.empty() || metrics_thread.joinable()) {
+            return;
+        }
+        metrics_stop = false;
+        int interval_seconds = std::max(1, metrics_interval);
+        metrics_thread = std::thread([this, interval_seconds] {
+            std::unique_lock<std::mutex> lock(metrics_mutex);
+            while (!metrics_condition.wait_for(lock, std::chrono::seconds(interval_seconds),
+                [this] { return metrics_stop; })) {
+                write_metrics_file();
+            }
+        });
+    }
 
-                    if (!img.empty() && is_valid_tile(img)) {
-                        tile.image = img;
-                        tile.valid = true;
-                        curl_easy_cleanup(curl);
-                        return tile;
-                    }
-                }
+    void stop_metrics_export() {
+        if (metrics_thread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(metrics_mutex);
+                metrics_stop = true;
             }
+            metrics_condition.notify_all();
+            metrics_thread.join();
+        }
+        if (!metrics_path.empty()) {
+            write_metrics_file();
+        }
+    }
 
-            // Only log error on final attempt
-            if (attempt == retry_count - 1) {
-                logger->log("Failed to download tile at (" + std::to_string(x) + ", " +
-                    std::to_string(y) + ") for " + panoid);
+    // Write to a temporary file and rename, so scrapers never see a partial file
+    void write_metrics_file() {
+        std::string temp_path = metrics_path + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                logger->log(LogLevel::warning, "Could not write metrics file " + temp_path);
+                return;
             }
+            file << metrics->to_prometheus();
+        }
+        std::error_code ec;
+        fs::rename(temp_path, metrics_path, ec);
+        if (ec) {
+            logger->log(LogLevel::warning, "Could not update metrics file " + metrics_path + ": " + ec.message());
         }
+    }
 
-        curl_easy_cleanup(curl);
-        return tile;
+    // Decode a fetched tile on the decode stage
+    std::future<Tile> submit_tile_decode(int x, int y, const std::string& panoid, std::string payload,
+        const std::shared_ptr<CancellationToken>& token) {
+        return decode_stage->submit([this, x, y, panoid, payload = std::move(payload), token]() {
+            TraceSpan span(tracer.get(), "decode_tile", "decode", panoid,
+                std::to_string(x) + "," + std::to_string(y));
+            Tile tile(x, y);
+            if (!payload.empty() && !token->is_cancelled()) {
+                tile.image = decode_tile(payload);
+                tile.valid = !tile.image.empty();
+                if (!tile.valid) {
+                    logger->log(LogLevel::warning, "Failed to decode tile at (" + std::to_string(x) + ", " +
+                        std::to_string(y) + ") for " + panoid);
+                }
+            }
+            return tile;
+            });
     }
 
     // Download all tiles in parallel
     std::map<std::pair<int, int>, cv::Mat> download_tiles_parallel(
-        const std::string& panoid, int zoom, int max_x, int max_y) {
+        const std::string& panoid, int zoom, int max_x, int max_y, const std::shared_ptr<CancellationToken>& token,
+        const std::shared_ptr<TileFetchStats>& stats) {
+        TraceSpan span(tracer.get(), "download_tiles_parallel", "network", panoid);
         std::map<std::pair<int, int>, cv::Mat> result;
         std::mutex result_mutex;
         std::atomic<int> completed(0);
         int total_tiles = max_x * max_y;
 
-        // Create vector of futures for parallel downloads
-        std::vector<std::future<Tile>> futures;
+        // Each fetch resolves to the pending decode of its tile
+        std::vector<std::future<std::future<Tile>>> futures;
         futures.reserve(total_tiles);
 
         // Determine optimal number of threads
         int effective_thread_count = std::min(tile_thread_count, total_tiles);
-        logger->log("Using " + std::to_string(effective_thread_count) + " threads for tile downloads");
+        logger->log(LogLevel::debug, "Using " + std::to_string(effective_thread_count) + " threads for tile downloads");
 
         // Submit download tasks
         for (int x = 0; x < max_x; ++x) {
             for (int y = 0; y < max_y; ++y) {
                 futures.push_back(
                     thread_pool->enqueue(
-                        [this, x, y, panoid, zoom]() {
+                        [this, x, y, panoid, zoom, token, stats]() {
+                            // Queued tiles of a lost panorama are released without any work
+                            if (token->is_cancelled()) {
+                                std::promise<Tile> skipped;
+                                skipped.set_value(Tile(x, y));
+                                return skipped.get_future();
+                            }
+
                             active_threads++;
-                            Tile tile = download_tile(x, y, panoid, zoom);
+                            bool permanent = false;
+                            std::string payload;
+                            {
+                                TraceSpan span(tracer.get(), "fetch_tile", "network", panoid,
+                                    std::to_string(x) + "," + std::to_string(y));
+                                payload = fetch_tile_payload(x, y, panoid, zoom, *token, *stats, permanent);
+                            }
                             active_threads--;
-                            return tile;
+
+                            if (permanent && max_failed_tiles > 0 && token->add_hard_failure() >= max_failed_tiles) {
+                                token->cancel(std::to_string(max_failed_tiles) + " tiles failed permanently");
+                            }
+                            return submit_tile_decode(x, y, panoid, std::move(payload), token);
                         }
                     )
                 );
@@ -873,7 +4092,8 @@ private:
 
         // Process results as they complete
         for (auto& future : futures) {
-            Tile tile = future.get();
+            std::future<Tile> decoded = thread_pool->wait(future);
+            Tile tile = thread_pool->wait(decoded);
 
             if (tile.valid) {
                 std::lock_guard<std::mutex> lock(result_mutex);
@@ -882,15 +4102,15 @@ private:
 
             // Update progress atomically
             completed++;
-            if (completed % 10 == 0 || completed == total_tiles) {
-                logger->log("Downloaded " + std::to_string(completed) + "/" +
+            if ((completed % 10 == 0 || completed == total_tiles) && logger->enabled(LogLevel::debug)) {
+                logger->log(LogLevel::debug, "Downloaded " + std::to_string(completed) + "/" +
                     std::to_string(total_tiles) + " tiles for " + panoid);
             }
         }
 
         // Check if any tiles were successfully downloaded
         int valid_tiles = result.size();
-        logger->log("Successfully downloaded " + std::to_string(valid_tiles) + " tiles for " + panoid);
+        logger->log(LogLevel::debug, "Successfully downloaded " + std::to_string(valid_tiles) + " tiles for " + panoid);
 
         return result;
     }
@@ -899,6 +4119,8 @@ private:
     cv::Mat stitch_panorama(
         const std::map<std::pair<int, int>, cv::Mat>& tiles,
         int max_x, int max_y, int zoom_level) {
+        ScopedTimer timer(metrics->stitch);
+
         // Check if we have any valid tiles
         if (tiles.empty()) {
             return cv::Mat();
@@ -1093,17 +4315,15 @@ private:
         }
     }
 
-    // Modified equirectangular to rectilinear projection with 90° horizontal FOV
+    // Modified equirectangular to rectilinear projection (90° horizontal FOV by default)
     cv::Mat equirect_to_rectilinear(
         const cv::Mat& panorama, double direction_rad, double vfov_rad, int output_size,
-        double pitch_rad = 0.0, double yaw_rad = 0.0) {
+        double pitch_rad = 0.0, double yaw_rad = 0.0, double hfov_rad = 90.0 * M_PI / 180.0) {
+        ScopedTimer timer(metrics->projection);
 
         int pano_width = panorama.cols;
         int pano_height = panorama.rows;
 
-        // The horizontal FOV should be 90 degrees (in radians)
-        double hfov_rad = 90.0 * M_PI / 180.0;
-
         // Create output image
         cv::Mat output(output_size, output_size, CV_8UC3, cv::Scalar(0, 0, 0));
 
@@ -1194,44 +4414,188 @@ private:
         return output;
     }
 
-    void create_directional_views_with_jitter(
-        const cv::Mat& panorama, const std::string& panoid,
-        const fs::path& output_dir, int generation, int zoom) {
-        logger->log("Creating 8 directional views with 90° FOV for complete coverage");
+    // Export the panorama as a Deep Zoom (DZI) pyramid, encoding it tile by tile
+    void export_pyramid_tiles(const cv::Mat& panorama, const std::string& panoid, const fs::path& output_dir) {
+        const int tile_size = 512;  // Matches the source tiles so the top level lines up with the grid
+
+        int max_level = static_cast<int>(std::ceil(std::log2(std::max(panorama.cols, panorama.rows))));
+        fs::path files_dir = output_dir / (panoid + "_files");
+
+        // Descriptor first so readers know the geometry
+        std::ofstream dzi(output_dir / (panoid + ".dzi"));
+        dzi << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            << "<Image xmlns=\"http://schemas.microsoft.com/deepzoom/2008\" TileSize=\"" << tile_size
+            << "\" Overlap=\"0\" Format=\"jpg\">\n"
+            << "  <Size Width=\"" << panorama.cols << "\" Height=\"" << panorama.rows << "\"/>\n"
+            << "</Image>\n";
+        dzi.close();
+
+        int tile_count = 0;
+        cv::Mat level_image = panorama;
+        for (int level = max_level; level >= 0; --level) {
+            fs::path level_dir = files_dir / std::to_string(level);
+            fs::create_directories(level_dir);
+
+            // Each tile is a view into the level image, encoded separately by the write-behind stage
+            for (int row = 0; row * tile_size < level_image.rows; ++row) {
+                for (int col = 0; col * tile_size < level_image.cols; ++col) {
+                    cv::Rect roi(col * tile_size, row * tile_size,
+                        std::min(tile_size, level_image.cols - col * tile_size),
+                        std::min(tile_size, level_image.rows - row * tile_size));
+                    fs::path tile_path = level_dir / (std::to_string(col) + "_" + std::to_string(row) + ".jpg");
+                    view_writer->submit(level_image(roi), tile_path.string());
+                    tile_count++;
+                }
+            }
+
+            if (level > 0) {
+                cv::Mat next_level;
+                cv::resize(level_image, next_level,
+                    cv::Size((level_image.cols + 1) / 2, (level_image.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+                level_image = next_level;
+            }
+        }
+
+        logger->log(LogLevel::debug, "Queued " + std::to_string(tile_count) + " pyramid tiles for " + panoid);
+    }
+
+    // Headings and names of the views; compass names for the standard 8 views
+    std::vector<std::pair<double, std::string>> view_directions() const {
+        if (view_config.num_views == 8) {
+            return {
+                {0.0, "N"},
+                {45.0, "NE"},
+                {90.0, "E"},
+                {135.0, "SE"},
+                {180.0, "S"},
+                {225.0, "SW"},
+                {270.0, "W"},
+                {315.0, "NW"}
+            };
+        }
+
+        std::vector<std::pair<double, std::string>> directions;
+        for (int i = 0; i < view_config.num_views; ++i) {
+            double heading = 360.0 * i / view_config.num_views;
+            std::ostringstream name;
+            name << "H" << std::setw(3) << std::setfill('0') << static_cast<int>(std::lround(heading));
+            directions.push_back({ heading, name.str() });
+        }
+        return directions;
+    }
+
+    std::string view_filename(const std::string& panoid, int index, const std::string& direction_name) const {
+        std::ostringstream filename_stream;
+        filename_stream << panoid << "_View" << index + 1 << "_" << direction_name << "_FOV"
+            << std::fixed << std::setprecision(1) << view_config.hfov_deg << ".jpg";
+        return filename_stream.str();
+    }
+
+    // Random engine for one panorama's jitter, reproducible per PanoID when a seed is given
+    std::mt19937 make_view_engine(const std::string& panoid) {
+        if (deterministic_seed) {
+            uint64_t panoid_hash = fnv1a_hash(panoid);
+            std::seed_seq seq{
+                static_cast<uint32_t>(seed_base), static_cast<uint32_t>(seed_base >> 32),
+                static_cast<uint32_t>(panoid_hash), static_cast<uint32_t>(panoid_hash >> 32)
+            };
+            return std::mt19937(seq);
+        }
+
+        std::lock_guard<std::mutex> lock(random_lock);
+        return std::mt19937(random_engine());
+    }
+
+    // Everything that determines the views' content besides the panorama itself
+    std::string view_signature(const std::string& source_tag) const {
+        std::ostringstream signature;
+        signature << "seed=" << seed_base
+            << " size=" << view_config.output_size << " views=" << view_config.num_views
+            << " hfov=" << view_config.hfov_deg << " vfov=" << view_config.vfov_deg
+            << " rotation_jitter=" << view_config.rotation_jitter_deg
+            << " fov_jitter=" << view_config.fov_jitter_deg
+            << " pitch=" << view_config.pitch_deg << " yaw=" << view_config.yaw_deg
+            << " quality=" << jpeg_quality << " crop=" << auto_crop << " labels=" << draw_tile_labels
+            << " pyramid=" << export_pyramid << " source=" << source_tag;
+        return signature.str();
+    }
+
+    fs::path view_stamp_path(const fs::path& output_dir, const std::string& panoid) const {
+        return output_dir / (panoid + ".views");
+    }
+
+    // With a deterministic seed, views rendered earlier with the same parameters are identical.
+    // Shards are only ever appended to, so a panorama already in views.idx is always skipped.
+    bool views_up_to_date(const std::string& panoid, const fs::path& output_dir, const std::string& source_tag) {
+        if (shard_output) {
+            return skip_existing && view_writer->in_shards(panoid, static_cast<int>(view_directions().size()));
+        }
+        if (!deterministic_seed || !skip_existing) {
+            return false;
+        }
+
+        std::ifstream stamp(view_stamp_path(output_dir, panoid));
+        std::string recorded;
+        if (!stamp.is_open() || !std::getline(stamp, recorded) || recorded != view_signature(source_tag)) {
+            return false;
+        }
+
+        auto directions = view_directions();
+        for (size_t i = 0; i < directions.size(); ++i) {
+            if (!fs::exists(output_dir / view_filename(panoid, static_cast<int>(i), directions[i].second))) {
+                return false;
+            }
+        }
+        return true;
+    }
 
-        int output_size = 512;
-        double vfov_deg = 90.0;  // Vertical field of view
-        int num_views = 8;
-        double fov_deg = 90.0;  // Horizontal field of view for each view (90°)
+    // Only written once the write stage has confirmed every view of the panorama
+    void write_view_stamp(const std::string& panoid, const fs::path& output_dir, const std::string& source_tag) {
+        if (!deterministic_seed || shard_output) {
+            return;
+        }
+        std::ofstream stamp(view_stamp_path(output_dir, panoid), std::ios::trunc);
+        stamp << view_signature(source_tag) << "\n";
+    }
+
+    // Views are about to be overwritten; an old stamp must not vouch for half-written files
+    void clear_view_stamp(const std::string& panoid, const fs::path& output_dir) {
+        if (!deterministic_seed || shard_output) {
+            return;
+        }
+        std::error_code error;
+        fs::remove(view_stamp_path(output_dir, panoid), error);
+    }
+
+    // Receives each rendered view with its 0-based index, direction name and final heading
+    using ViewSink = std::function<void(cv::Mat&&, int, const std::string&, double)>;
 
-        // Each view is separated by 45° (360° / 8 = 45°)
-        // With 90° FOV, we get 45° of overlap between adjacent views
+    // Cut the jittered directional views out of a panorama and hand each one to sink
+    void render_directional_views(const cv::Mat& panorama, const std::string& panoid,
+        std::mt19937& view_engine, const ViewSink& sink) {
+        const auto directions = view_directions();
+        int num_views = static_cast<int>(directions.size());
+        double fov_deg = view_config.hfov_deg;  // Horizontal field of view for each view
+
+        logger->log(LogLevel::debug, "Creating " + std::to_string(num_views) + " directional views with " +
+            std::to_string(fov_deg) + "° FOV for complete coverage");
 
         // Set up random distributions for jitter
-        std::uniform_real_distribution<double> global_rotation_dist(-22.5, 22.5);
-        std::uniform_real_distribution<double> fov_jitter_dist(-5.0, 5.0);
+        std::uniform_real_distribution<double> global_rotation_dist(-view_config.rotation_jitter_deg,
+            view_config.rotation_jitter_deg);
+        std::uniform_real_distribution<double> fov_jitter_dist(-view_config.fov_jitter_deg,
+            view_config.fov_jitter_deg);
 
         // Add small amount of pitch for more natural looking views
-        double pitch_rad = 5.0 * M_PI / 180.0;
-        double yaw_rad = 5.0 * M_PI / 180.0;
+        double pitch_rad = view_config.pitch_deg * M_PI / 180.0;
+        double yaw_rad = view_config.yaw_deg * M_PI / 180.0;
+        double hfov_rad = fov_deg * M_PI / 180.0;
 
         // Generate a global rotation to apply to all directions
-        double global_rotation = global_rotation_dist(random_engine);
-        logger->log("Global rotation for all directions: " + std::to_string(global_rotation) + "°");
-
-        // Define exact view directions for the 8 standard orientations
-        const std::vector<std::pair<double, std::string>> directions = {
-            {0.0, "N"},
-            {45.0, "NE"},
-            {90.0, "E"},
-            {135.0, "SE"},
-            {180.0, "S"},
-            {225.0, "SW"},
-            {270.0, "W"},
-            {315.0, "NW"}
-        };
+        double global_rotation = global_rotation_dist(view_engine);
+        logger->log(LogLevel::debug, "Global rotation for all directions: " + std::to_string(global_rotation) + "°");
 
-        // Create the 8 directional views
+        // Create the directional views
         for (int i = 0; i < num_views; ++i) {
             // Get the base direction and name
             double base_direction_deg = directions[i].first;
@@ -1241,161 +4605,571 @@ private:
             double final_direction_deg = fmod(base_direction_deg + global_rotation + 360.0, 360.0);
 
             // Add small random jitter to FOV
-            double vfov_jitter = fov_jitter_dist(random_engine);
-            double final_vfov_deg = vfov_deg + vfov_jitter;
+            double vfov_jitter = fov_jitter_dist(view_engine);
+            double final_vfov_deg = view_config.vfov_deg + vfov_jitter;
 
-            // Ensure FOV stays in reasonable range
-            final_vfov_deg = std::max(75.0, std::min(110.0, final_vfov_deg));
+            // The jitter already bounds the spread around the configured FOV; only keep the
+            // projection defined
+            final_vfov_deg = std::max(1.0, std::min(179.0, final_vfov_deg));
 
             // Convert degrees to radians
             double direction_rad = final_direction_deg * M_PI / 180.0;
             double vfov_rad = final_vfov_deg * M_PI / 180.0;
 
             // Log info
-            logger->log("View " + std::to_string(i + 1) + ": " + direction_name +
-                " at " + std::to_string(final_direction_deg) + "° with FOV " +
-                std::to_string(fov_deg) + "° horizontal, " +
-                std::to_string(final_vfov_deg) + "° vertical");
+            if (logger->enabled(LogLevel::debug)) {
+                logger->log(LogLevel::debug, "View " + std::to_string(i + 1) + ": " + direction_name +
+                    " at " + std::to_string(final_direction_deg) + "° with FOV " +
+                    std::to_string(fov_deg) + "° horizontal, " +
+                    std::to_string(final_vfov_deg) + "° vertical");
+            }
 
             // Generate the rectilinear view with pitch and yaw adjustments
-            cv::Mat output = equirect_to_rectilinear(panorama, direction_rad, vfov_rad, output_size, pitch_rad, yaw_rad);
+            cv::Mat output;
+            {
+                TraceSpan view_span(tracer.get(), "equirect_to_rectilinear", "project", panoid,
+                    "view " + std::to_string(i + 1));
+                output = equirect_to_rectilinear(panorama, direction_rad, vfov_rad,
+                    view_config.output_size, pitch_rad, yaw_rad, hfov_rad);
+            }
 
-            // Create output filename
-            std::string gen_suffix = include_gen_in_filename ? "_gen" + std::to_string(generation) : "";
+            sink(std::move(output), i, direction_name, final_direction_deg);
+        }
+    }
+
+    // Returns the file paths (or shard member names) the views were queued under
+    std::vector<std::string> create_directional_views_with_jitter(
+        const cv::Mat& panorama, const std::string& panoid, const fs::path& output_dir,
+        std::mt19937& view_engine, const std::shared_ptr<ViewWriter::Group>& group = nullptr) {
+        TraceSpan span(tracer.get(), "create_directional_views_with_jitter", "project", panoid);
+        std::vector<std::string> outputs;
+        outputs.reserve(view_config.num_views);
+
+        render_directional_views(panorama, panoid, view_engine,
+            [&](cv::Mat&& view, int i, const std::string& direction_name, double) {
+                // Hand the view to the write-behind stage and move on
+                if (shard_output) {
+                    // WebDataset groups members by the name before the first dot
+                    std::string member = "view" + std::to_string(i + 1) + "_" + direction_name + ".jpg";
+                    outputs.push_back(panoid + "." + member);
+                    view_writer->submit(std::move(view), member, panoid, i + 1, group);
+                    logger->log(LogLevel::debug, "Queued directional view " + std::to_string(i + 1) + " for shard output");
+                }
+                else {
+                    fs::path output_path = output_dir / view_filename(panoid, i, direction_name);
+                    outputs.push_back(output_path.string());
+                    view_writer->submit(std::move(view), output_path.string(), panoid, i + 1, group);
+                    logger->log(LogLevel::debug, "Queued directional view: " + output_path.string());
+                }
+            });
 
-            std::ostringstream filename_stream;
-            filename_stream << panoid << "_View" << i + 1 << "_" << direction_name << "_FOV" << std::fixed << std::setprecision(1) << fov_deg << ".jpg";
+        return outputs;
+    }
 
-            fs::path output_path = output_dir / filename_stream.str();
+    // Render the directional views of a panorama into memory
+    std::vector<StreetViewView> render_views_to_memory(const cv::Mat& panorama, const std::string& panoid) {
+        TraceSpan span(tracer.get(), "render_views_to_memory", "project", panoid);
+        std::vector<StreetViewView> views;
+        views.reserve(view_config.num_views);
+
+        std::mt19937 view_engine = make_view_engine(panoid);
+        render_directional_views(panorama, panoid, view_engine,
+            [&views](cv::Mat&& image, int i, const std::string& direction_name, double heading_deg) {
+                StreetViewView view;
+                view.index = i + 1;
+                view.direction = direction_name;
+                view.heading_deg = heading_deg;
+                view.image = std::move(image);
+                views.push_back(std::move(view));
+            });
+        return views;
+    }
 
-            // Save the image
-            cv::imwrite(output_path.string(), output);
-            logger->log("Saved directional view: " + output_path.string());
+    // Parse an attribute value out of a Deep Zoom descriptor
+    static std::string dzi_attribute(const std::string& xml, const std::string& name) {
+        std::string key = name + "=\"";
+        size_t start = xml.find(key);
+        if (start == std::string::npos) {
+            return "";
         }
+        start += key.size();
+        size_t end = xml.find('"', start);
+        return end == std::string::npos ? "" : xml.substr(start, end - start);
     }
 
-    // Process a single panorama
-    bool process_panorama(const std::string& panoid, const fs::path& output_dir) {
-        try {
-            logger->log("Processing panorama " + panoid);
-            logger->log("Detecting generation for " + panoid);
+    // Reassemble the full-resolution level of a Deep Zoom tile set
+    cv::Mat load_dzi_panorama(const fs::path& dzi_path) {
+        std::ifstream file(dzi_path);
+        std::string xml((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        std::string width_attr = dzi_attribute(xml, "Width");
+        std::string height_attr = dzi_attribute(xml, "Height");
+        std::string tile_attr = dzi_attribute(xml, "TileSize");
+        if (width_attr.empty() || height_attr.empty() || tile_attr.empty()) {
+            throw std::runtime_error("Invalid Deep Zoom descriptor: " + dzi_path.string());
+        }
+
+        int width = std::stoi(width_attr);
+        int height = std::stoi(height_attr);
+        int tile_size = std::stoi(tile_attr);
+        std::string overlap_attr = dzi_attribute(xml, "Overlap");
+        int overlap = overlap_attr.empty() ? 0 : std::stoi(overlap_attr);
+        std::string format = dzi_attribute(xml, "Format");
+        if (format.empty()) {
+            format = "jpg";
+        }
+
+        int max_level = static_cast<int>(std::ceil(std::log2(std::max(width, height))));
+        fs::path level_dir = dzi_path.parent_path() / (dzi_path.stem().string() + "_files") / std::to_string(max_level);
+
+        cv::Mat panorama(height, width, CV_8UC3, cv::Scalar(0, 0, 0));
+        for (int row = 0; row * tile_size < height; ++row) {
+            for (int col = 0; col * tile_size < width; ++col) {
+                fs::path tile_path = level_dir / (std::to_string(col) + "_" + std::to_string(row) + "." + format);
+                cv::Mat tile = cv::imread(tile_path.string(), cv::IMREAD_COLOR);
+                if (tile.empty()) {
+                    throw std::runtime_error("Missing pyramid tile: " + tile_path.string());
+                }
+
+                // Tiles past the first row/column start with the overlap from their neighbour
+                int skip_x = col > 0 ? overlap : 0;
+                int skip_y = row > 0 ? overlap : 0;
+                int copy_width = std::min({ tile_size, width - col * tile_size, tile.cols - skip_x });
+                int copy_height = std::min({ tile_size, height - row * tile_size, tile.rows - skip_y });
+                if (copy_width <= 0 || copy_height <= 0) {
+                    continue;
+                }
+
+                cv::Mat destination = panorama(cv::Rect(col * tile_size, row * tile_size, copy_width, copy_height));
+                tile(cv::Rect(skip_x, skip_y, copy_width, copy_height)).copyTo(destination);
+            }
+        }
 
-            // Check generation cache first
-            auto cached_gen = get_cached_generation(panoid);
-            int generation = 0;
-            std::string description;
+        return panorama;
+    }
 
-            if (cached_gen.first != 0) {
-                generation = cached_gen.first;
-                description = cached_gen.second;
-                logger->log("Using cached generation: " + description);
+    // Re-render views from a stored panorama without touching the network
+    bool reproject_panorama(const fs::path& input_path, const fs::path& output_dir) {
+        std::string panoid = input_path.stem().string();
+        TraceSpan span(tracer.get(), "reproject_panorama", "panorama", panoid);
+        auto start = std::chrono::steady_clock::now();
+        PanoramaResult result;
+        result.panoid = panoid;
+
+        try {
+            logger->log(LogLevel::debug, "Reprojecting stored panorama " + input_path.string());
+
+            // Inputs are identified by size and modification time so edited panoramas are re-rendered
+            std::string source_tag = std::to_string(fs::file_size(input_path)) + ":" +
+                std::to_string(fs::last_write_time(input_path).time_since_epoch().count());
+            if (views_up_to_date(panoid, output_dir, source_tag)) {
+                logger->log("Views for " + panoid + " are up to date, skipping");
+                result.success = true;
+                result.skipped = true;
             }
             else {
-                // Detect the generation
-                auto gen_result = detect_generation(panoid);
-                generation = gen_result.first;
-                description = gen_result.second;
+                std::string extension = input_path.extension().string();
+                std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+                cv::Mat panorama = extension == ".dzi" ?
+                    load_dzi_panorama(input_path) : cv::imread(input_path.string(), cv::IMREAD_COLOR);
+
+                if (panorama.empty()) {
+                    logger->log(LogLevel::warning, "Failed to load stored panorama " + input_path.string());
+                    result.fail(FailureCode::load_failed, false, "could not read " + input_path.string());
+                }
+                else {
+                    auto stage_start = std::chrono::steady_clock::now();
+                    std::mt19937 view_engine = make_view_engine(panoid);
+                    auto group = std::make_shared<ViewWriter::Group>();
+                    clear_view_stamp(panoid, output_dir);
+                    result.outputs = create_directional_views_with_jitter(panorama, panoid, output_dir, view_engine, group);
+                    std::future<int> written = ViewWriter::seal(group);
+                    panorama.release();
+                    result.success = confirm_views_written(panoid, written, result);
+                    if (result.success) {
+                        write_view_stamp(panoid, output_dir, source_tag);
+                    }
+                    result.views_ms = elapsed_ms(stage_start);
+                }
+            }
+        }
+        catch (const std::exception& e) {
+            logger->log(LogLevel::error, "Error reprojecting " + input_path.string() + ": " + e.what());
+            result.fail(FailureCode::error, true, e.what());
+        }
 
-                // Cache the result
-                cache_generation(panoid, generation, description);
+        if (!result.success) {
+            record_failed_pano(panoid);
+        }
+        result.total_ms = elapsed_ms(start);
+        if (result_writer) {
+            result_writer->write(result);
+        }
+        return result.success;
+    }
+
+    // Find stored panoramas (Deep Zoom descriptors or equirectangular images) in a directory
+    std::vector<std::string> find_stored_panoramas(const fs::path& input_dir) {
+        static const std::set<std::string> extensions = {
+            ".dzi", ".jpg", ".jpeg", ".png", ".tif", ".tiff", ".webp"
+        };
+
+        std::vector<std::string> inputs;
+        for (const auto& entry : fs::directory_iterator(input_dir)) {
+            if (!entry.is_regular_file()) {
+                continue;
             }
 
-            if (generation == 0) {
-                logger->log("Could not detect generation for " + panoid);
-                record_failed_pano(panoid);
-                return false;
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+            // Skip directional views written into the same directory
+            if (extensions.count(extension) && entry.path().stem().string().find("_View") == std::string::npos) {
+                inputs.push_back(entry.path().string());
             }
+        }
 
-            logger->log("Detected " + description);
+        std::sort(inputs.begin(), inputs.end());
+        return inputs;
+    }
 
-            // Get the configuration for this generation
-            GenerationConfig config = get_generation_config(generation);
+    // Time one panorama and turn exceptions into failures; with allow_requeue, a retryable
+    // failure during a tile service outage marks the panorama for another attempt
+    void run_panorama(const std::string& panoid, PanoramaResult& result,
+        const std::function<bool(PanoramaResult&)>& body, bool allow_requeue) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t trips_at_start = breaker->trip_count();
+        result.panoid = panoid;
 
-            // Skip checking for existing files since we're only creating directional views
+        try {
+            result.success = body(result);
+        }
+        catch (const std::exception& e) {
+            logger->log(LogLevel::error, "Error processing " + panoid + ": " + e.what());
+            result.fail(FailureCode::error, true, e.what());
+        }
 
-            // Download tiles
-            logger->log("Downloading tiles for " + panoid);
-            auto tiles = download_tiles_parallel(panoid, config.zoom, config.max_x, config.max_y);
+        // A retryable failure during a tile service outage says nothing about the panorama itself
+        if (allow_requeue && !result.success && result.retryable &&
+            (breaker->trip_count() != trips_at_start || breaker->is_open()) && mark_requeued(panoid)) {
+            logger->log(LogLevel::warning, "Re-queueing " + panoid + " after a tile service outage");
+            result.requeued = true;
+        }
+        result.total_ms = elapsed_ms(start);
+    }
 
-            // Check if we have valid tiles
-            if (tiles.empty()) {
-                logger->log("Failed to download tiles for " + panoid);
-                record_failed_pano(panoid);
+    // Process a single panorama into output_dir and report its outcome to the results stream
+    bool process_panorama(const std::string& panoid, const fs::path& output_dir) {
+        PanoramaResult result;
+        run_panorama(panoid, result, [&](PanoramaResult& outcome) {
+            if (views_up_to_date(panoid, output_dir, "download")) {
+                logger->log("Views for " + panoid + " are up to date, skipping");
+                outcome.skipped = true;
+                return true;
+            }
+            std::future<int> written;
+            if (!download_panorama(panoid, outcome, [&](cv::Mat& panorama, PanoramaResult& stitched) {
+                written = write_panorama_outputs(panoid, output_dir, panorama, stitched);
+                })) {
                 return false;
             }
-
-            // Count valid tiles
-            int valid_tiles = tiles.size();
-            if (valid_tiles == 0) {
-                logger->log("No valid tiles found for " + panoid);
-                record_failed_pano(panoid);
+            if (!confirm_views_written(panoid, written, outcome)) {
                 return false;
             }
+            write_view_stamp(panoid, output_dir, "download");
+            return true;
+            }, true);
+
+        if (!result.success && !result.requeued) {
+            record_failed_pano(panoid);
+        }
+        if (result_writer) {
+            result_writer->write(result);
+        }
+        return result.success;
+    }
 
-            // Stitch panorama
-            logger->log("Stitching panorama from " + std::to_string(valid_tiles) + " tiles");
-            cv::Mat panorama = stitch_panorama(tiles, config.max_x, config.max_y, config.zoom);
+    // Fetch one panorama into out, keeping the stitched image and/or rendering its views.
+    // Returns false when the panorama was re-queued and out holds no final outcome yet.
+    bool fetch_to_memory(const std::string& panoid, bool keep_panorama, bool with_views,
+        bool allow_requeue, StreetViewPanorama& out) {
+        PanoramaResult result;
+        run_panorama(panoid, result, [&](PanoramaResult& outcome) {
+            return download_panorama(panoid, outcome, [&](cv::Mat& panorama, PanoramaResult& stitched) {
+                if (with_views) {
+                    auto stage_start = std::chrono::steady_clock::now();
+                    out.views = render_views_to_memory(panorama, panoid);
+                    stitched.views_ms = elapsed_ms(stage_start);
+                }
+                if (keep_panorama) {
+                    out.panorama = std::move(panorama);
+                }
+                });
+            }, allow_requeue);
 
-            if (panorama.empty()) {
-                logger->log("Failed to stitch panorama for " + panoid);
-                record_failed_pano(panoid);
-                return false;
+        if (result_writer) {
+            result_writer->write(result);
+        }
+        if (result.requeued) {
+            return false;
+        }
+
+        out.panoid = panoid;
+        out.success = result.success;
+        out.failure = result.failure;
+        out.retryable = result.retryable;
+        out.message = result.message;
+        out.http_status = result.http_status;
+        out.generation = result.generation;
+        out.total_ms = result.total_ms;
+        return true;
+    }
+
+    static double elapsed_ms(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Receives the stitched (and cropped) panorama on the stitch stage
+    using PanoramaConsumer = std::function<void(cv::Mat&, PanoramaResult&)>;
+
+    // Detect, fetch and stitch one panorama, filling in result along the way, and hand the
+    // panorama to consume
+    bool download_panorama(const std::string& panoid, PanoramaResult& result, const PanoramaConsumer& consume) {
+        TraceSpan span(tracer.get(), "process_panorama", "panorama", panoid);
+        logger->log(LogLevel::debug, "Processing panorama " + panoid);
+
+        logger->log(LogLevel::debug, "Detecting generation for " + panoid);
+
+        // The deadline covers generation detection as well as the tiles
+        auto token = std::make_shared<CancellationToken>(panorama_timeout);
+
+        // Check generation cache first
+        auto stage_start = std::chrono::steady_clock::now();
+        auto cached_gen = get_cached_generation(panoid);
+        int generation = 0;
+        std::string description;
+        TileFetchStats probe_stats;
+
+        if (cached_gen.first != 0) {
+            generation = cached_gen.first;
+            description = cached_gen.second;
+            logger->log(LogLevel::debug, "Using cached generation: " + description);
+        }
+        else {
+            // Detect the generation
+            auto gen_result = generation_flights.run(panoid, [&]() {
+                return detect_generation(panoid, &probe_stats, token.get());
+                });
+            generation = gen_result.first;
+            description = gen_result.second;
+
+            // Cache the result
+            cache_generation(panoid, generation, description);
+        }
+        result.detect_ms = elapsed_ms(stage_start);
+
+        if (generation == 0 && token->was_cancelled()) {
+            logger->log(LogLevel::warning, "Abandoning " + panoid + " during generation detection: " + token->reason());
+            result.fail(FailureCode::timeout, true, token->reason());
+            return false;
+        }
+
+        if (generation == 0) {
+            logger->log(LogLevel::warning, "Could not detect generation for " + panoid);
+            result.http_status = probe_stats.last_http_status;
+            result.fail(FailureCode::detection_failed, probe_stats.saw_transient_error(), "no generation probe succeeded");
+            return false;
+        }
+
+        logger->log(LogLevel::debug, "Detected " + description);
+
+        // Get the configuration for this generation
+        GenerationConfig config = get_generation_config(generation);
+        result.generation = generation;
+        result.zoom = config.zoom;
+        result.tiles_total = config.max_x * config.max_y;
+
+        // Skip checking for existing files since we're only creating directional views
+
+        // Download tiles
+        logger->log(LogLevel::debug, "Downloading tiles for " + panoid);
+        stage_start = std::chrono::steady_clock::now();
+        auto stats = std::make_shared<TileFetchStats>();
+        auto tiles = download_tiles_parallel(panoid, config.zoom, config.max_x, config.max_y, token, stats);
+        result.fetch_ms = elapsed_ms(stage_start);
+        result.tiles_fetched = static_cast<int>(tiles.size());
+        result.tiles_retried = stats->retried_tiles;
+        result.tiles_blank = stats->blank_tiles;
+        result.bytes = stats->bytes;
+        result.http_status = stats->last_http_status;
+
+        // A panorama is only abandoned when the cancellation cut the fetch short; a deadline
+        // passing after the last tile arrived does not throw away a complete panorama
+        int missing_tiles = result.tiles_total - static_cast<int>(tiles.size()) - stats->blank_tiles;
+        if (token->was_cancelled() && missing_tiles > 0) {
+            logger->log(LogLevel::warning, "Abandoning " + panoid + ": " + token->reason());
+            if (token->timed_out()) {
+                result.fail(FailureCode::timeout, true, token->reason());
+            }
+            else {
+                result.fail(FailureCode::too_many_failed_tiles, false, token->reason());
+            }
+            return false;
+        }
+
+        // Check if we have valid tiles
+        if (tiles.empty()) {
+            logger->log(LogLevel::warning, "Failed to download tiles for " + panoid);
+            int status = stats->last_http_status;
+            if (stats->blank_tiles == result.tiles_total) {
+                result.fail(FailureCode::all_tiles_blank, false, "every tile was blank");
             }
+            else if (status == 429 || status >= 500) {
+                result.fail(FailureCode::http_error, true, "tiles failed with HTTP " + std::to_string(status));
+            }
+            else if (stats->transport_errors > 0) {
+                result.fail(FailureCode::network_error, true, "tile transfers failed");
+            }
+            else if (status != 0) {
+                result.fail(FailureCode::http_error, false, "tiles failed with HTTP " + std::to_string(status));
+            }
+            else if (stats->blank_tiles > 0) {
+                result.fail(FailureCode::all_tiles_blank, false, "no tile had content");
+            }
+            else {
+                result.fail(FailureCode::error, false, "no tile could be decoded");
+            }
+            return false;
+        }
 
-            // Crop if needed and auto-crop is enabled
-            if (config.crop && auto_crop && !draw_tile_labels) {
-                logger->log("Cropping panorama");
-                panorama = crop_panorama(panorama, generation);
+        // Tiles lost to a transient error would be stitched as black holes; fail retryably so
+        // the panorama is fetched again instead of being reported complete
+        if (missing_tiles > 0 && stats->saw_transient_error()) {
+            logger->log(LogLevel::warning, std::to_string(missing_tiles) + " tiles of " + panoid + " failed transiently");
+            int status = stats->last_http_status;
+            if (status == 429 || status >= 500) {
+                result.fail(FailureCode::http_error, true,
+                    std::to_string(missing_tiles) + " tiles failed with HTTP " + std::to_string(status));
             }
+            else {
+                result.fail(FailureCode::network_error, true, std::to_string(missing_tiles) + " tile transfers failed");
+            }
+            return false;
+        }
 
-            // Skip saving the full panorama
-            // Instead, just proceed to creating directional views
+        // Stitching and whatever consumes the panorama run on the stitch stage
+        std::future<bool> finished = stitch_stage->submit([&]() {
+            return finish_panorama(panoid, tiles, config, generation, result, consume);
+            });
+        return thread_pool->wait(finished);
+    }
 
-            // Create directional views
-            logger->log("Creating directional views with random jitter");
-            create_directional_views_with_jitter(panorama, panoid, output_dir, generation, config.zoom);
+    // Stitch decoded tiles and hand the panorama to consume
+    bool finish_panorama(const std::string& panoid, const std::map<std::pair<int, int>, cv::Mat>& tiles,
+        const GenerationConfig& config, int generation, PanoramaResult& result, const PanoramaConsumer& consume) {
+        int valid_tiles = tiles.size();
 
-            return true;
+        // Stitch panorama
+        logger->log(LogLevel::debug, "Stitching panorama from " + std::to_string(valid_tiles) + " tiles");
+        auto stage_start = std::chrono::steady_clock::now();
+        cv::Mat panorama;
+        {
+            TraceSpan span(tracer.get(), "stitch_panorama", "stitch", panoid);
+            panorama = stitch_panorama(tiles, config.max_x, config.max_y, config.zoom);
         }
-        catch (const std::exception& e) {
-            logger->log("Error processing " + panoid + ": " + e.what());
-            record_failed_pano(panoid);
+
+        if (panorama.empty()) {
+            logger->log(LogLevel::warning, "Failed to stitch panorama for " + panoid);
+            result.fail(FailureCode::stitch_failed, false, "stitching produced no image");
             return false;
         }
-    }
 
-    // Parse PANOIDs from a file - now enhanced to handle different CSV formats
-    std::vector<std::string> parse_panoids_from_file(const std::string& file_path) {
-        std::vector<std::string> panoids;
+        // Crop if needed and auto-crop is enabled
+        if (config.crop && auto_crop && !draw_tile_labels) {
+            logger->log(LogLevel::debug, "Cropping panorama");
+            panorama = crop_panorama(panorama, generation);
+        }
+        result.stitch_ms = elapsed_ms(stage_start);
 
-        try {
-            // Check file extension
-            fs::path path(file_path);
-            std::string extension = path.extension().string();
-            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+        consume(panorama, result);
+        return true;
+    }
 
-            // If it's a CSV file, use the CSV handler
-            if (extension == ".csv") {
-                try {
-                    csv_handler = std::make_shared<CSVHandler>(file_path);
-                    panoids = csv_handler->get_panoids();
-                    logger->log("Loaded " + std::to_string(panoids.size()) + " PanoIDs from CSV file");
+    // Optionally export the pyramid, then queue the directional views for the encode/write stage.
+    // The returned future reports how many views failed once all of them are written.
+    std::future<int> write_panorama_outputs(const std::string& panoid, const fs::path& output_dir,
+        const cv::Mat& panorama, PanoramaResult& result) {
+        // The full panorama is never encoded as one image; optionally export it as a tiled pyramid
+        auto stage_start = std::chrono::steady_clock::now();
+        if (export_pyramid) {
+            logger->log(LogLevel::debug, "Exporting tiled pyramid for " + panoid);
+            export_pyramid_tiles(panorama, panoid, output_dir);
+            result.outputs.push_back((output_dir / (panoid + ".dzi")).string());
+            result.stitch_ms += elapsed_ms(stage_start);
+        }
 
-                    if (clean_csv_output) {
-                        logger->log("CSV cleanup enabled. Will generate cleaned CSV after processing.");
-                    }
+        // Create directional views
+        logger->log(LogLevel::debug, "Creating directional views with random jitter");
+        stage_start = std::chrono::steady_clock::now();
+        std::mt19937 view_engine = make_view_engine(panoid);
+        auto group = std::make_shared<ViewWriter::Group>();
+        clear_view_stamp(panoid, output_dir);
+        std::vector<std::string> views = create_directional_views_with_jitter(panorama, panoid, output_dir, view_engine, group);
+        result.outputs.insert(result.outputs.end(), views.begin(), views.end());
+        result.views_ms = elapsed_ms(stage_start);
+        return ViewWriter::seal(group);
+    }
 
-                    return panoids;
-                }
-                catch (const std::exception& e) {
-                    logger->log("Error parsing CSV: " + std::string(e.what()) + ". Falling back to simple line parsing.");
+    // Wait for the write stage to confirm a panorama's views; any lost view fails the panorama
+    bool confirm_views_written(const std::string& panoid, std::future<int>& written, PanoramaResult& result) {
+        auto stage_start = std::chrono::steady_clock::now();
+        int failures = thread_pool->wait(written);
+        result.views_ms += elapsed_ms(stage_start);
+        if (failures > 0) {
+            logger->log(LogLevel::warning, std::to_string(failures) + " views of " + panoid + " could not be written");
+            result.fail(FailureCode::write_failed, true, std::to_string(failures) + " views could not be written");
+            return false;
+        }
+        return true;
+    }
+
+    // Open a file of PANOIDs as a work source; CSV files are streamed as they are parsed
+    WorkSource open_panoid_source(const std::string& file_path) {
+        // Check file extension
+        fs::path path(file_path);
+        std::string extension = path.extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+
+        // If it's a CSV file, use the CSV handler
+        if (extension == ".csv") {
+            try {
+                csv_handler = std::make_shared<CSVHandler>(file_path);
+                logger->log("Streaming PanoIDs from CSV file");
+
+                if (clean_csv_output) {
+                    logger->log("CSV cleanup enabled. Will generate cleaned CSV after processing.");
                 }
+
+                std::shared_ptr<CSVHandler> handler = csv_handler;
+                return [handler](std::string& panoid) { return handler->next_panoid(panoid); };
             }
+            catch (const std::exception& e) {
+                logger->log(LogLevel::warning, "Error parsing CSV: " + std::string(e.what()) + ". Falling back to simple line parsing.");
+            }
+        }
 
+        return make_list_source(parse_panoids_from_file(file_path));
+    }
+
+    // Parse PANOIDs from a plain text file (one per line or simple CSV)
+    std::vector<std::string> parse_panoids_from_file(const std::string& file_path) {
+        std::vector<std::string> panoids;
+
+        try {
             // Fallback to simple text file parsing
             std::ifstream file(file_path);
             if (!file.is_open()) {
-                logger->log("Error: Could not open file " + file_path);
+                logger->log(LogLevel::error, "Error: Could not open file " + file_path);
                 return panoids;
             }
 
@@ -1429,6 +5203,7 @@ private:
                 }
 
                 if (!panoids.empty()) {
+                    remove_duplicate_panoids(panoids);
                     return panoids;
                 }
             }
@@ -1448,47 +5223,132 @@ private:
             }
         }
         catch (const std::exception& e) {
-            logger->log("Error reading file: " + std::string(e.what()));
+            logger->log(LogLevel::error, "Error reading file: " + std::string(e.what()));
+        }
+
+        remove_duplicate_panoids(panoids);
+        return panoids;
+    }
+
+    // Drop repeated PanoIDs, keeping the first occurrence and the input order
+    void remove_duplicate_panoids(std::vector<std::string>& panoids) {
+        CompactHashMap seen;
+        size_t kept = 0;
+        for (size_t i = 0; i < panoids.size(); i++) {
+            uint64_t unused;
+            // Kept PanoIDs are compacted to the front, so the map stores their new position
+            if (seen.insert(fnv1a_hash(panoids[i]), kept, unused,
+                [&panoids, i](uint64_t index) { return panoids[index] == panoids[i]; })) {
+                if (kept != i) {
+                    panoids[kept] = std::move(panoids[i]);
+                }
+                kept++;
+            }
+        }
+
+        if (kept < panoids.size()) {
+            logger->log("Skipped " + std::to_string(panoids.size() - kept) + " duplicate PanoIDs in input");
+            panoids.resize(kept);
+        }
+    }
+
+    // Open the cleaned CSV output; rows are streamed into it while panoramas complete
+    bool start_cleaned_csv() {
+        if (!clean_csv_output || !csv_handler) {
+            return false;
+        }
+
+        // If no output path is specified, create one based on the input path
+        std::string output_file = csv_output_path;
+        if (output_file.empty()) {
+            fs::path input_path(csv_handler->get_file_path());
+            fs::path dir = input_path.parent_path();
+            std::string stem = input_path.stem().string();
+            output_file = (dir / (stem + "_cleaned.csv")).string();
+        }
+
+        if (!csv_handler->begin_cleaned_csv(output_file)) {
+            logger->log(LogLevel::error, "Failed to open cleaned CSV file: " + output_file);
+            return false;
         }
 
-        return panoids;
+        csv_output_path = output_file;
+        logger->log("Writing cleaned CSV to: " + output_file);
+        return true;
     }
 
-    // Generate a clean CSV file with failed panoramas removed
-    void generate_cleaned_csv() {
-        if (!csv_handler || failed_panoids.empty() || csv_output_path.empty()) {
-            return;
+    void finish_cleaned_csv() {
+        if (csv_handler->finish_cleaned_csv()) {
+            logger->log("Successfully wrote cleaned CSV with " + std::to_string(failed_panoids.size()) +
+                " failed panoramas removed to: " + csv_output_path);
+        }
+        else {
+            logger->log(LogLevel::error, "Failed to write cleaned CSV file!");
         }
+    }
 
-        try {
-            logger->log("Generating cleaned CSV file with " + std::to_string(failed_panoids.size()) +
-                " failed panoramas removed...");
+    // (Re)create the encode/write stage, writing shards into output_dir when enabled
+    void init_view_writer(const fs::path& output_dir = fs::path()) {
+        std::shared_ptr<ShardWriter> shards;
+        if (shard_output && !output_dir.empty()) {
+            shards = std::make_shared<ShardWriter>(output_dir,
+                static_cast<uint64_t>(shard_size_mb) * 1024 * 1024);
+        }
+        view_writer = std::make_shared<ViewWriter>(encode_thread_count, encode_thread_count * 16,
+            jpeg_quality, logger, metrics, tracer, shards);
+    }
 
-            // If no output path is specified, create one based on the input path
-            std::string output_file = csv_output_path;
-            if (output_file.empty()) {
-                fs::path input_path(csv_handler->get_file_path());
-                fs::path dir = input_path.parent_path();
-                std::string stem = input_path.stem().string();
-                output_file = (dir / (stem + "_cleaned.csv")).string();
-            }
+    // Size the decode and stitch stages; a tile is small, a stitched panorama is not
+    void init_stages() {
+        decode_stage = std::make_shared<StageExecutor>("decode", decode_thread_count, decode_thread_count * 64);
+        stitch_stage = std::make_shared<StageExecutor>("stitch", stitch_thread_count, stitch_thread_count * 2);
+    }
 
-            // Write the cleaned CSV
-            if (csv_handler->write_cleaned_csv(failed_panoids, output_file)) {
-                logger->log("Successfully wrote cleaned CSV to: " + output_file);
-            }
-            else {
-                logger->log("Failed to write cleaned CSV file!");
-            }
-        }
-        catch (const std::exception& e) {
-            logger->log("Error generating cleaned CSV: " + std::string(e.what()));
+    // Current queue depth of every pipeline stage, for progress logging
+    std::string stage_depths() {
+        return "fetch " + std::to_string(thread_pool->queued()) +
+            ", decode " + std::to_string(decode_stage->depth()) + "/" + std::to_string(decode_stage->queue_capacity()) +
+            ", stitch " + std::to_string(stitch_stage->depth()) + "/" + std::to_string(stitch_stage->queue_capacity()) +
+            (view_writer ? ", encode " + std::to_string(view_writer->queue_depth()) + "/" +
+                std::to_string(view_writer->queue_capacity()) : std::string());
+    }
+
+    // Take the settings of a library client; only called before the components are built
+    void apply_options(const StreetViewOptions& options) {
+        report_progress = false;
+        tile_host = options.tile_host;
+        while (!tile_host.empty() && tile_host.back() == '/') {
+            tile_host.pop_back();
         }
+        tile_thread_count = options.tile_threads;
+        pano_thread_count = options.pano_threads;
+        max_total_threads = options.max_threads;
+        timeout_value = options.timeout_seconds;
+        retry_count = options.retries;
+        panorama_timeout = options.panorama_timeout;
+        max_failed_tiles = options.max_failed_tiles;
+        auto_crop = options.auto_crop;
+
+        view_config.output_size = options.view_size;
+        view_config.num_views = std::max(1, options.num_views);
+        view_config.hfov_deg = options.hfov_deg;
+        view_config.vfov_deg = options.vfov_deg;
+        view_config.pitch_deg = options.pitch_deg;
+        view_config.yaw_deg = options.yaw_deg;
+        view_config.rotation_jitter_deg = options.rotation_jitter_deg;
+        view_config.fov_jitter_deg = options.fov_jitter_deg;
+        deterministic_seed = options.deterministic_seed;
+        seed_base = options.seed;
+
+        hedge_percentile = options.hedge_percentile;
+        hedge_budget = options.hedge_budget;
+        breaker_threshold = options.breaker_threshold;
+        breaker_window = options.breaker_window;
+        breaker_cooldown = options.breaker_cooldown;
     }
 
-public:
-    // Constructor with default settings
-    StreetViewDownloader() :
+    // Shared by both public constructors; with options, every component is built once from them
+    StreetViewDownloader(const std::string& log_file, bool console_log, const StreetViewOptions* options) :
         retry_count(3),
         timeout_value(10),
         tile_thread_count(128),
@@ -1500,16 +5360,56 @@ public:
         draw_tile_labels(false),
         create_directional_views(true),
         clean_csv_output(false),
+        jpeg_quality(95),
+        encode_thread_count(std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / 2)),
+        decode_thread_count(std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / 2)),
+        stitch_thread_count(std::max(1, static_cast<int>(std::thread::hardware_concurrency()))),
+        panorama_timeout(0),
+        max_failed_tiles(0),
+        shard_output(false),
+        shard_size_mb(1024),
+        export_pyramid(false),
+        tile_host("https://streetviewpixels-pa.googleapis.com"),
         download_progress(0),
         active_threads(0),
-        random_engine(std::random_device{}())
+        report_progress(true),
+        metrics_interval(10),
+        metrics_stop(false),
+        breaker_threshold(0.5),
+        breaker_window(10),
+        breaker_cooldown(5),
+        hedge_percentile(0),
+        hedge_budget(5),
+        random_engine(std::random_device{}()),
+        deterministic_seed(false),
+        seed_base(0)
     {
         // Initialize logger
-        logger = std::make_shared<Logger>("streetview_downloader.log", true);
+        logger = std::make_shared<Logger>(log_file, console_log);
 
         // Initialize thread pool
-        thread_pool = std::make_shared<ThreadPool>(std::min(max_total_threads,
-            static_cast<int>(std::thread::hardware_concurrency())));
+        if (options) {
+            apply_options(*options);
+            thread_pool = std::make_shared<ThreadPool>(std::min(max_total_threads,
+                std::max(tile_thread_count, pano_thread_count)));
+        }
+        else {
+            thread_pool = std::make_shared<ThreadPool>(std::min(max_total_threads,
+                static_cast<int>(std::thread::hardware_concurrency())));
+        }
+
+        // Initialize metrics and tracing before the stages that record into them
+        metrics = std::make_shared<Metrics>();
+        tracer = std::make_shared<TraceRecorder>();
+
+        breaker = std::make_shared<CircuitBreaker>(breaker_threshold, breaker_window, breaker_cooldown, logger, metrics);
+
+        // Initialize the decode, stitch and encode/write stages; library clients keep views in
+        // memory and need no encode/write stage
+        init_stages();
+        if (!options) {
+            init_view_writer();
+        }
 
         // Initialize CURL globally
         curl_global_init(CURL_GLOBAL_ALL);
@@ -1520,8 +5420,19 @@ public:
         headers = curl_slist_append(headers, "Accept: image/webp,image/apng,image/*,*/*;q=0.8");
     }
 
+public:
+    // Constructor with default settings
+    explicit StreetViewDownloader(const std::string& log_file = "streetview_downloader.log", bool console_log = true) :
+        StreetViewDownloader(log_file, console_log, nullptr) {}
+
+    // Library client: quiet, logging only to options.log_file
+    explicit StreetViewDownloader(const StreetViewOptions& options) :
+        StreetViewDownloader(options.log_file, false, &options) {}
+
     // Destructor to clean up resources
     ~StreetViewDownloader() {
+        stop_metrics_export();
+
         // Clean up CURL resources
         if (headers) {
             curl_slist_free_all(headers);
@@ -1533,6 +5444,16 @@ public:
     // Setters for configuration
     void set_retry_count(int count) { retry_count = count; }
     void set_timeout_value(int timeout) { timeout_value = timeout; }
+    void set_panorama_timeout(double seconds) { panorama_timeout = seconds; }
+    void set_max_failed_tiles(int count) { max_failed_tiles = count; }
+    void set_trace_output(const std::string& path) {
+        trace_path = path;
+        tracer->enable();
+    }
+    void set_metrics_output(const std::string& path, int interval_seconds = 10) {
+        metrics_path = path;
+        metrics_interval = interval_seconds;
+    }
     void set_tile_thread_count(int count) { tile_thread_count = count; }
     void set_pano_thread_count(int count) {
         pano_thread_count = count;
@@ -1550,76 +5471,270 @@ public:
         clean_csv_output = value;
         csv_output_path = output_path;
     }
+    void set_jpeg_quality(int quality) {
+        jpeg_quality = quality;
+        init_view_writer();
+    }
+    void set_export_pyramid(bool value) { export_pyramid = value; }
+    void set_view_config(const ViewConfig& config) { view_config = config; }
+    void set_seed(uint64_t seed) {
+        deterministic_seed = true;
+        seed_base = seed;
+    }
+    void set_shard_output(bool value, int max_size_mb = 1024) {
+        shard_output = value;
+        shard_size_mb = max_size_mb;
+    }
+    void set_encode_thread_count(int count) {
+        encode_thread_count = count;
+        init_view_writer();
+    }
+    void set_decode_thread_count(int count) {
+        decode_thread_count = count;
+        init_stages();
+    }
+    void set_stitch_thread_count(int count) {
+        stitch_thread_count = count;
+        init_stages();
+    }
+
+    // A percentile of zero disables hedged tile requests
+    void set_hedging(double percentile, double budget_percent = 5) {
+        hedge_percentile = percentile;
+        hedge_budget = budget_percent;
+    }
+    // A threshold of zero disables the circuit breaker
+    void set_circuit_breaker(double threshold, double window_seconds, double cooldown_seconds) {
+        breaker_threshold = threshold;
+        breaker_window = window_seconds;
+        breaker_cooldown = cooldown_seconds;
+        breaker = std::make_shared<CircuitBreaker>(breaker_threshold, breaker_window, breaker_cooldown, logger, metrics);
+    }
 
     // Process multiple panoramas with multi-level parallelism
     std::pair<int, int> process_panoids(const std::vector<std::string>& panoids, const fs::path& output_dir) {
-        int total = panoids.size();
-        std::atomic<int> successful(0);
-        std::atomic<int> failed(0);
-        std::atomic<int> completed(0);
+        return process_panoids(make_list_source(panoids), output_dir);
+    }
+
+    // Process panoramas as the source yields them, so work starts before the input is fully read
+    std::pair<int, int> process_panoids(const WorkSource& next_panoid, const fs::path& output_dir) {
+        logger->log("Processing panoramas with " + std::to_string(pano_thread_count) + " concurrent panoramas");
+
+        // Feed each outcome back to the CSV so finished rows are written out immediately
+        ResultCallback on_result;
+        bool cleaning = start_cleaned_csv();
+        if (cleaning) {
+            on_result = [this](size_t item_index, bool success) {
+                csv_handler->set_item_result(item_index, !success);
+                csv_handler->emit_cleaned_rows();
+            };
+        }
+
+        auto result = run_panorama_tasks(next_panoid, [this, &output_dir](const std::string& panoid) {
+            return panorama_flights.run(panoid, [&]() {
+                return process_panorama(panoid, output_dir);
+                });
+            }, on_result);
+
+        if (csv_handler && csv_handler->duplicate_count() > 0) {
+            logger->log("Skipped " + std::to_string(csv_handler->duplicate_count()) + " duplicate PanoIDs in input");
+        }
+
+        if (cleaning) {
+            finish_cleaned_csv();
+        }
+        return result;
+    }
+
+    // Fetch a batch into memory; each final outcome goes to on_result, re-queued panoramas retry first
+    StreetViewBatchSummary process_batch_to_memory(const std::vector<std::string>& panoids,
+        const StreetViewClient::ResultCallback& on_result, bool keep_panorama) {
+        // Every batch gets the full number of re-queues per panorama
+        {
+            std::lock_guard<std::mutex> lock(failed_panoids_mutex);
+            requeue_counts.clear();
+            requeued_panoids.clear();
+        }
+        logger->log("Fetching " + std::to_string(panoids.size()) + " panoramas into memory with " +
+            std::to_string(pano_thread_count) + " concurrent panoramas");
+
+        auto [successful, failed] = run_panorama_tasks(make_list_source(panoids),
+            [this, &on_result, keep_panorama](const std::string& panoid) {
+                StreetViewPanorama outcome;
+                if (!fetch_to_memory(panoid, keep_panorama, true, true, outcome)) {
+                    return false;
+                }
+                bool success = outcome.success;
+                if (on_result) {
+                    on_result(std::move(outcome));
+                }
+                return success;
+            });
+
+        StreetViewBatchSummary summary;
+        summary.successful = successful;
+        summary.failed = failed;
+        return summary;
+    }
 
-        logger->log("Processing " + std::to_string(total) + " panoramas with " +
+    // Re-render views for stored panoramas using only the projection and output stages
+    std::pair<int, int> reproject_panoramas(const std::vector<std::string>& inputs, const fs::path& output_dir) {
+        logger->log("Reprojecting " + std::to_string(inputs.size()) + " stored panoramas with " +
             std::to_string(pano_thread_count) + " concurrent panoramas");
 
-        // Initialize progress bar
-        progress_bar = std::make_shared<ProgressBar>(total);
+        return run_panorama_tasks(make_list_source(inputs), [this, &output_dir](const std::string& input) {
+            return reproject_panorama(input, output_dir);
+            });
+    }
 
-        // Create a vector to store futures for each panorama processing task
-        std::vector<std::future<bool>> futures;
-        futures.reserve(total);
+    // Run one task per item on the thread pool with progress reporting
+    std::pair<int, int> run_panorama_tasks(const WorkSource& next_item,
+        const std::function<bool(const std::string&)>& task, const ResultCallback& on_result = nullptr) {
+        int total = 0;
+        std::atomic<int> successful(0);
+        std::atomic<int> failed(0);
+        std::atomic<int> completed(0);
 
-        // Process panoramas in batches to control memory usage
-        const int batch_size = pano_thread_count * 2;
+        // Initialize progress reporting; the renderer thread redraws it at a fixed rate
+        progress_bar = std::make_shared<ProgressBar>(total, metrics);
+        if (report_progress) {
+            progress_bar->start();
+        }
+        start_metrics_export();
 
-        for (int start = 0; start < total; start += batch_size) {
-            int end = std::min(start + batch_size, total);
-            futures.clear();
+        // Keep a fixed number of panoramas in flight and admit a new one whenever a slot frees,
+        // so a single slow panorama no longer holds back the rest of the pool
+        const int window_size = std::max(pano_thread_count, 1);
 
-            // Start processing a batch of panoramas
-            for (int i = start; i < end; ++i) {
-                const std::string& panoid = panoids[i];
-                futures.push_back(
-                    thread_pool->enqueue(
-                        [this, panoid, &output_dir]() {
-                            return process_panorama(panoid, output_dir);
-                        }
-                    )
-                );
-            }
+        // Finished tasks report here; results are handled in completion order
+        struct Finished {
+            size_t index;
+            bool success;
+            std::string item;
+        };
+        std::mutex done_mutex;
+        std::condition_variable done_condition;
+        std::deque<Finished> done;
 
-            // Wait for the batch to complete
-            for (auto& future : futures) {
-                bool success = future.get();
-                if (success) {
-                    successful++;
+        // Items re-queued after a tile service outage keep their source index
+        std::deque<std::pair<size_t, std::string>> retry_items;
+
+        int in_flight = 0;
+        bool exhausted = false;
+        std::string item;
+        while (true) {
+            // Refill the window, re-queued items first, then as the source yields items
+            while (in_flight < window_size) {
+                size_t index;
+                if (!retry_items.empty()) {
+                    index = retry_items.front().first;
+                    item = std::move(retry_items.front().second);
+                    retry_items.pop_front();
+                }
+                else if (exhausted || !next_item(item)) {
+                    exhausted = true;
+                    break;
                 }
                 else {
-                    failed++;
+                    index = total++;
                 }
 
-                // Update completed count and progress bar
-                completed++;
-                progress_bar->update(completed, successful, failed);
+                in_flight++;
+                thread_pool->post([&task, &done_mutex, &done_condition, &done, item, index]() {
+                    // Tiles of earlier admitted panoramas run first, so each panorama
+                    // finishes (and frees its tiles) as early as possible
+                    ThreadPool::PriorityScope priority(index);
+                    bool success = false;
+                    try {
+                        success = task(item);
+                    }
+                    catch (...) {
+                        success = false;
+                    }
 
-                // Update progress periodically
-                if (completed % 5 == 0 || completed == total) {
-                    logger->log("Progress: " + std::to_string(completed) + "/" + std::to_string(total) +
-                        " complete (" + std::to_string(successful) + " successful, " +
-                        std::to_string(failed) + " failed)");
-                }
+                    {
+                        std::lock_guard<std::mutex> lock(done_mutex);
+                        done.push_back({ index, success, item });
+                    }
+                    done_condition.notify_one();
+                    });
+                progress_bar->set_total(total);
+            }
+
+            if (in_flight == 0) {
+                break;
+            }
+
+            // Wait for the next panorama to finish, whichever it is
+            Finished result;
+            {
+                std::unique_lock<std::mutex> lock(done_mutex);
+                done_condition.wait(lock, [&done] { return !done.empty(); });
+                result = std::move(done.front());
+                done.pop_front();
+            }
+            in_flight--;
+
+            bool success = result.success;
+            if (!success && take_requeued(result.item)) {
+                metrics->panoramas_requeued++;
+                retry_items.emplace_back(result.index, std::move(result.item));
+                continue;
+            }
+
+            if (success) {
+                successful++;
+                metrics->panoramas_succeeded++;
+            }
+            else {
+                failed++;
+                metrics->panoramas_failed++;
+            }
+
+            if (on_result) {
+                on_result(result.index, success);
+            }
+
+            completed++;
+            progress_bar->record_result(success);
+
+            // Update progress periodically
+            if (completed % 5 == 0 || (exhausted && completed == total)) {
+                logger->log("Progress: " + std::to_string(completed) + "/" + std::to_string(total) +
+                    " complete (" + std::to_string(successful) + " successful, " +
+                    std::to_string(failed) + " failed); queued: " + stage_depths());
+            }
+        }
+
+        logger->log("Peak stage queue depths: decode " + std::to_string(decode_stage->peak_depth()) +
+            "/" + std::to_string(decode_stage->queue_capacity()) + ", stitch " +
+            std::to_string(stitch_stage->peak_depth()) + "/" + std::to_string(stitch_stage->queue_capacity()));
+
+        // Wait for queued views to reach the disk
+        if (view_writer) {
+            view_writer->flush();
+            if (view_writer->failure_count() > 0) {
+                logger->log(LogLevel::warning, std::to_string(view_writer->failure_count()) + " views could not be written");
             }
         }
 
-        // Hide progress bar before final message
-        progress_bar->hide();
+        logger->log(metrics->summary());
+        stop_metrics_export();
 
-        // Generate cleaned CSV if requested
-        if (clean_csv_output && csv_handler) {
-            generate_cleaned_csv();
+        if (!trace_path.empty()) {
+            if (tracer->write(trace_path)) {
+                logger->log("Wrote trace timeline to " + trace_path);
+            }
+            else {
+                logger->log(LogLevel::error, "Failed to write trace file " + trace_path);
+            }
         }
 
+        // Stop the renderer before the final message
+        progress_bar->stop();
+
         // Print failed panorama IDs if any
-        if (failed > 0) {
+        if (failed > 0 && report_progress) {
             print_failed_panoids();
         }
 
@@ -1636,6 +5751,7 @@ public:
         // Parse command-line arguments
         std::string panoid;
         std::string file_path;
+        std::string reproject_dir;
         fs::path output_dir = fs::path(getenv("HOME") ? getenv("HOME") : ".") / "streetview_output";
         bool has_input = false;
 
@@ -1673,11 +5789,104 @@ public:
                     timeout_value = std::stoi(argv[++i]);
                 }
             }
+            else if (arg == "--panorama-timeout") {
+                if (i + 1 < argc) {
+                    panorama_timeout = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--max-failed-tiles") {
+                if (i + 1 < argc) {
+                    max_failed_tiles = std::stoi(argv[++i]);
+                }
+            }
             else if (arg == "--retries") {
                 if (i + 1 < argc) {
                     retry_count = std::stoi(argv[++i]);
                 }
             }
+            else if (arg == "--jpeg-quality") {
+                if (i + 1 < argc) {
+                    jpeg_quality = std::stoi(argv[++i]);
+                }
+            }
+            else if (arg == "--encode-threads") {
+                if (i + 1 < argc) {
+                    encode_thread_count = std::stoi(argv[++i]);
+                }
+            }
+            else if (arg == "--decode-threads") {
+                if (i + 1 < argc) {
+                    decode_thread_count = std::stoi(argv[++i]);
+                }
+            }
+            else if (arg == "--stitch-threads") {
+                if (i + 1 < argc) {
+                    stitch_thread_count = std::stoi(argv[++i]);
+                }
+            }
+            else if (arg == "--reproject") {
+                if (i + 1 < argc) {
+                    reproject_dir = argv[++i];
+                    has_input = true;
+                }
+            }
+            else if (arg == "--seed") {
+                if (i + 1 < argc) {
+                    deterministic_seed = true;
+                    seed_base = std::stoull(argv[++i]);
+                }
+            }
+            else if (arg == "--view-size") {
+                if (i + 1 < argc) {
+                    view_config.output_size = std::stoi(argv[++i]);
+                }
+            }
+            else if (arg == "--views") {
+                if (i + 1 < argc) {
+                    view_config.num_views = std::max(1, std::stoi(argv[++i]));
+                }
+            }
+            else if (arg == "--hfov") {
+                if (i + 1 < argc) {
+                    view_config.hfov_deg = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--vfov") {
+                if (i + 1 < argc) {
+                    view_config.vfov_deg = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--pitch") {
+                if (i + 1 < argc) {
+                    view_config.pitch_deg = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--yaw") {
+                if (i + 1 < argc) {
+                    view_config.yaw_deg = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--rotation-jitter") {
+                if (i + 1 < argc) {
+                    view_config.rotation_jitter_deg = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--fov-jitter") {
+                if (i + 1 < argc) {
+                    view_config.fov_jitter_deg = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--pyramid") {
+                export_pyramid = true;
+            }
+            else if (arg == "--shards") {
+                shard_output = true;
+            }
+            else if (arg == "--shard-size") {
+                if (i + 1 < argc) {
+                    shard_size_mb = std::stoi(argv[++i]);
+                }
+            }
             else if (arg == "--no-gen-suffix") {
                 include_gen_in_filename = false;
             }
@@ -1693,6 +5902,77 @@ public:
             else if (arg == "--no-directional") {
                 create_directional_views = false;
             }
+            else if (arg == "--tile-host") {
+                if (i + 1 < argc) {
+                    tile_host = argv[++i];
+                    while (!tile_host.empty() && tile_host.back() == '/') {
+                        tile_host.pop_back();
+                    }
+                }
+            }
+            else if (arg == "--hedge") {
+                if (i + 1 < argc) {
+                    hedge_percentile = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--hedge-budget") {
+                if (i + 1 < argc) {
+                    hedge_budget = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--breaker-threshold") {
+                if (i + 1 < argc) {
+                    breaker_threshold = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--breaker-window") {
+                if (i + 1 < argc) {
+                    breaker_window = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--breaker-cooldown") {
+                if (i + 1 < argc) {
+                    breaker_cooldown = std::stod(argv[++i]);
+                }
+            }
+            else if (arg == "--results") {
+                if (i + 1 < argc) {
+                    results_path = argv[++i];
+                }
+            }
+            else if (arg == "--trace") {
+                if (i + 1 < argc) {
+                    trace_path = argv[++i];
+                    tracer->enable();
+                }
+            }
+            else if (arg == "--metrics") {
+                if (i + 1 < argc) {
+                    metrics_path = argv[++i];
+                }
+            }
+            else if (arg == "--metrics-interval") {
+                if (i + 1 < argc) {
+                    metrics_interval = std::stoi(argv[++i]);
+                }
+            }
+            else if (arg == "--log-level") {
+                if (i + 1 < argc) {
+                    std::string level = argv[++i];
+                    if (level == "debug") {
+                        logger->set_level(LogLevel::debug);
+                    }
+                    else if (level == "warning" || level == "warn") {
+                        logger->set_level(LogLevel::warning);
+                    }
+                    else if (level == "error") {
+                        logger->set_level(LogLevel::error);
+                    }
+                    else {
+                        logger->set_level(LogLevel::info);
+                    }
+                }
+            }
             else if (arg == "--clean-csv") {
                 clean_csv_output = true;
                 if (i + 1 < argc && argv[i + 1][0] != '-') {
@@ -1710,9 +5990,16 @@ public:
             }
         }
 
-        // Re-initialize thread pool with configured values
+        // Reprojection is CPU-bound, so spread it across all cores
+        if (!reproject_dir.empty()) {
+            pano_thread_count = std::max(pano_thread_count, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+
+        // Re-initialize thread pool and pipeline stages with configured values
         thread_pool = std::make_shared<ThreadPool>(std::min(max_total_threads,
             std::max(tile_thread_count, pano_thread_count)));
+        init_stages();
+        breaker = std::make_shared<CircuitBreaker>(breaker_threshold, breaker_window, breaker_cooldown, logger, metrics);
 
         // Create output directory
         try {
@@ -1720,46 +6007,93 @@ public:
             logger->log("Output directory: " + output_dir.string());
         }
         catch (const std::exception& e) {
-            logger->log("Error creating output directory: " + std::string(e.what()));
+            logger->log(LogLevel::error, "Error creating output directory: " + std::string(e.what()));
+            return 1;
+        }
+
+        // Re-initialize the encode/write stage with configured values
+        try {
+            init_view_writer(output_dir);
+        }
+        catch (const std::exception& e) {
+            logger->log(LogLevel::error, "Error opening shard output: " + std::string(e.what()));
             return 1;
         }
 
+        // Results are appended, so a rescheduled batch extends the same stream
+        if (!results_path.empty()) {
+            result_writer = std::make_shared<ResultWriter>(results_path);
+            if (!result_writer->is_open()) {
+                logger->log(LogLevel::error, "Error opening results file " + results_path);
+                return 1;
+            }
+            logger->log("Writing per-panorama results to " + results_path);
+        }
+
+        // Reproject-only mode skips detection and downloads entirely
+        if (!reproject_dir.empty()) {
+            std::vector<std::string> inputs;
+            try {
+                inputs = find_stored_panoramas(reproject_dir);
+            }
+            catch (const std::exception& e) {
+                logger->log(LogLevel::error, "Error reading stored panoramas: " + std::string(e.what()));
+                return 1;
+            }
+
+            if (inputs.empty()) {
+                logger->log(LogLevel::error, "Error: No stored panoramas found in " + reproject_dir);
+                return 1;
+            }
+
+            auto start_time = std::chrono::high_resolution_clock::now();
+            auto [successful, failed] = reproject_panoramas(inputs, output_dir);
+            view_writer->close();
+            auto end_time = std::chrono::high_resolution_clock::now();
+
+            double duration = std::chrono::duration<double>(end_time - start_time).count();
+            logger->log("Reprojection complete in " + std::to_string(duration) + " seconds");
+            logger->log("Successful: " + std::to_string(successful) + "/" + std::to_string(inputs.size()));
+            logger->log("Failed: " + std::to_string(failed) + "/" + std::to_string(inputs.size()));
+            return (failed == 0) ? 0 : 1;
+        }
+
         // Process PANOIDs
-        std::vector<std::string> panoids;
+        WorkSource panoid_source;
 
         if (!panoid.empty()) {
             // Single PANOID mode
-            panoids.push_back(panoid);
+            panoid_source = make_list_source({ panoid });
             logger->log("Processing single PANOID: " + panoid);
         }
         else if (!file_path.empty()) {
-            // File mode
+            // File mode; CSV files are parsed while the first panoramas are already running
             logger->log("Reading PANOIDs from file: " + file_path);
-            panoids = parse_panoids_from_file(file_path);
-
-            if (panoids.empty()) {
-                logger->log("Error: No valid PANOIDs found in file.");
-                return 1;
-            }
-
-            logger->log("Found " + std::to_string(panoids.size()) + " PANOIDs to process");
+            panoid_source = open_panoid_source(file_path);
         }
         else {
-            logger->log("Error: No PANOID or file specified.");
+            logger->log(LogLevel::error, "Error: No PANOID or file specified.");
             print_usage(argv[0]);
             return 1;
         }
 
         // Process all PANOIDs
         auto start_time = std::chrono::high_resolution_clock::now();
-        auto [successful, failed] = process_panoids(panoids, output_dir);
+        auto [successful, failed] = process_panoids(panoid_source, output_dir);
+        view_writer->close();
         auto end_time = std::chrono::high_resolution_clock::now();
 
+        int processed = successful + failed;
+        if (processed == 0) {
+            logger->log(LogLevel::error, "Error: No valid PANOIDs found in file.");
+            return 1;
+        }
+
         // Print summary
         double duration = std::chrono::duration<double>(end_time - start_time).count();
         logger->log("Processing complete in " + std::to_string(duration) + " seconds");
-        logger->log("Successful: " + std::to_string(successful) + "/" + std::to_string(panoids.size()));
-        logger->log("Failed: " + std::to_string(failed) + "/" + std::to_string(panoids.size()));
+        logger->log("Successful: " + std::to_string(successful) + "/" + std::to_string(processed));
+        logger->log("Failed: " + std::to_string(failed) + "/" + std::to_string(processed));
 
         // Add this line to print failed panorama IDs
         if (failed > 0) {
@@ -1787,11 +6121,28 @@ public:
         std::cout << "Input options:" << std::endl;
         std::cout << "  PANOID                Single PANOID to download" << std::endl;
         std::cout << "  -f, --file FILE       File containing PANOIDs (one per line or CSV)" << std::endl;
+        std::cout << "  --reproject DIR       Re-render views from stored panoramas (.dzi or images) in DIR" << std::endl;
+        std::cout << "  --tile-host URL       Base URL of the tile server (default: https://streetviewpixels-pa.googleapis.com)" << std::endl;
         std::cout << std::endl;
         std::cout << "Output options:" << std::endl;
         std::cout << "  -o, --output DIR      Output directory for saved panoramas" << std::endl;
         std::cout << "  --clean-csv [FILE]    Create cleaned CSV file with failed panoramas removed" << std::endl;
         std::cout << "                        Optional: specify output file path" << std::endl;
+        std::cout << "  --pyramid             Export the full panorama as a Deep Zoom (DZI) tile pyramid" << std::endl;
+        std::cout << "  --shards              Write views into tar shards with a views.idx index" << std::endl;
+        std::cout << "  --shard-size MB       Maximum size of each shard in MB (default: 1024)" << std::endl;
+        std::cout << std::endl;
+        std::cout << "View options:" << std::endl;
+        std::cout << "  --view-size N         Width and height of each view in pixels (default: 512)" << std::endl;
+        std::cout << "  --views N             Number of views around the panorama (default: 8)" << std::endl;
+        std::cout << "  --hfov DEG            Horizontal field of view (default: 90)" << std::endl;
+        std::cout << "  --vfov DEG            Vertical field of view before jitter (default: 90)" << std::endl;
+        std::cout << "  --pitch DEG           Pitch of every view (default: 5)" << std::endl;
+        std::cout << "  --yaw DEG             Yaw adjustment of every view (default: 5)" << std::endl;
+        std::cout << "  --rotation-jitter DEG Maximum global rotation jitter (default: 22.5)" << std::endl;
+        std::cout << "  --fov-jitter DEG      Maximum vertical FOV jitter (default: 5)" << std::endl;
+        std::cout << "  --seed N              Seed jitter per PanoID so reruns reproduce identical views" << std::endl;
+        std::cout << "                        and skip views already rendered with the same parameters" << std::endl;
         std::cout << std::endl;
         std::cout << "Performance options:" << std::endl;
         std::cout << "  -t, --tile-threads N  Number of download threads per panorama (default: 128)" << std::endl;
@@ -1799,6 +6150,19 @@ public:
         std::cout << "  --max-threads N       Maximum total number of threads (default: 512)" << std::endl;
         std::cout << "  --timeout N           Download timeout in seconds (default: 10)" << std::endl;
         std::cout << "  --retries N           Number of download retries (default: 3)" << std::endl;
+        std::cout << "  --panorama-timeout S  Abandon a panorama not downloaded after S seconds (default: off)" << std::endl;
+        std::cout << "  --max-failed-tiles N  Abandon a panorama after N tiles fail with 404 or blank (default: off)" << std::endl;
+        std::cout << "  --hedge P             Send a duplicate request for tiles slower than the P-th percentile" << std::endl;
+        std::cout << "                        of recent tile latency; the first response wins (default: off)" << std::endl;
+        std::cout << "  --hedge-budget PCT    Maximum hedged requests as a percentage of tile requests (default: 5)" << std::endl;
+        std::cout << "  --breaker-threshold R Pause all downloads when this fraction of tile requests fails with" << std::endl;
+        std::cout << "                        429/5xx/network errors; 0 disables (default: 0.5)" << std::endl;
+        std::cout << "  --breaker-window S    Sliding window for the error rate in seconds (default: 10)" << std::endl;
+        std::cout << "  --breaker-cooldown S  Pause before the first recovery probe in seconds (default: 5)" << std::endl;
+        std::cout << "  --encode-threads N    Number of threads encoding and writing views (default: cores / 2)" << std::endl;
+        std::cout << "  --decode-threads N    Number of threads decoding tiles (default: cores / 2)" << std::endl;
+        std::cout << "  --stitch-threads N    Number of threads stitching and projecting panoramas (default: cores)" << std::endl;
+        std::cout << "  --jpeg-quality N      JPEG quality for saved views (default: 95)" << std::endl;
         std::cout << std::endl;
         std::cout << "Other options:" << std::endl;
         std::cout << "  --no-gen-suffix       Do not include generation in filename" << std::endl;
@@ -1806,6 +6170,11 @@ public:
         std::cout << "  --no-skip             Do not skip existing files" << std::endl;
         std::cout << "  --labels              Draw tile labels (x,y,zoom)" << std::endl;
         std::cout << "  --no-directional      Do not create directional views" << std::endl;
+        std::cout << "  --log-level LEVEL     Minimum log level: debug, info, warning, error (default: info)" << std::endl;
+        std::cout << "  --results FILE        Append one JSON line per finished panorama to FILE (outcome, failure code, timings)" << std::endl;
+        std::cout << "  --trace FILE          Record a timeline of every panorama and tile stage to FILE (Chrome trace JSON)" << std::endl;
+        std::cout << "  --metrics FILE        Write stage latency histograms and counters to FILE (Prometheus text format)" << std::endl;
+        std::cout << "  --metrics-interval N  Seconds between metrics file updates (default: 10)" << std::endl;
         std::cout << "  -h, --help            Show this help message" << std::endl;
     }
 
@@ -1830,37 +6199,82 @@ public:
 
         // If clean CSV option is enabled, mention it
         if (clean_csv_output) {
-            logger->log("These failed panoramas will be excluded from the cleaned CSV output.");
+            logger->log("These failed panoramas have been excluded from the cleaned CSV output.");
         }
     }
 };
 
-// Main entry point
-int main(int argc, char* argv[]) {
-    try {
-        // Display ASCII art banner if no arguments provided
-        if (argc == 1) {
-            // ASCII art banner
-            std::cout << "\n"
-                << "░█▀▀░▀█▀░█▀▄░█▀▀░█▀▀░▀█▀░█░█░▀█▀░█▀▀░█░█\n"
-                << "░▀▀█░░█░░█▀▄░█▀▀░█▀▀░░█░░▀▄▀░░█░░█▀▀░█▄█\n"
-                << "░▀▀▀░░▀░░▀░▀░▀▀▀░▀▀▀░░▀░░░▀░░▀▀▀░▀▀▀░▀░▀\n"
-                << "░█▀▄░█▀█░█░█░█▀█░█░░░█▀█░█▀█░█▀▄░█▀▀░█▀▄\n"
-                << "░█░█░█░█░█▄█░█░█░█░░░█░█░█▀█░█░█░█▀▀░█▀▄\n"
-                << "░▀▀░░▀▀▀░▀░▀░▀░▀░▀▀▀░▀▀▀░▀░▀░▀▀░░▀▀▀░▀░▀\n\n";
-
-            // Create a downloader instance just to display usage info
-            StreetViewDownloader downloader;
-            downloader.print_usage(argv[0]);
-            return 0;
-        }
+StreetViewClient::StreetViewClient(const StreetViewOptions& options) :
+    downloader(std::make_unique<StreetViewDownloader>(options)) {}
+
+StreetViewClient::~StreetViewClient() {
+    // Queued work still refers to the pipeline, so let it drain first
+    std::unique_lock<std::mutex> lock(pending_mutex);
+    pending_done.wait(lock, [this] { return pending == 0; });
+}
+
+void StreetViewClient::begin_call() {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    pending++;
+}
 
-        // Normal execution with arguments
-        StreetViewDownloader downloader;
-        return downloader.run(argc, argv);
+void StreetViewClient::end_call() {
+    std::lock_guard<std::mutex> lock(pending_mutex);
+    if (--pending == 0) {
+        pending_done.notify_all();
     }
-    catch (const std::exception& e) {
-        std::cerr << "Fatal error: " << e.what() << std::endl;
-        return 1;
+}
+
+// Run f on the downloader's pool, counted as pending until it finishes
+template<class F>
+auto StreetViewClient::submit(F&& f) -> std::future<decltype(f())> {
+    begin_call();
+    return downloader->thread_pool->enqueue([this, f = std::forward<F>(f)]() mutable {
+        struct CallScope {
+            StreetViewClient* client;
+            ~CallScope() { client->end_call(); }
+        } scope{ this };
+        return f();
+        });
+}
+
+std::future<StreetViewPanorama> StreetViewClient::fetch_panorama(const std::string& panoid, bool with_views) {
+    return submit([this, panoid, with_views]() {
+        StreetViewPanorama outcome;
+        downloader->fetch_to_memory(panoid, true, with_views, false, outcome);
+        return outcome;
+        });
+}
+
+std::future<std::vector<StreetViewView>> StreetViewClient::render_views(cv::Mat panorama, const std::string& panoid) {
+    return submit([this, panorama, panoid]() {
+        return downloader->render_views_to_memory(panorama, panoid);
+        });
+}
+
+std::future<StreetViewBatchSummary> StreetViewClient::process_batch(std::vector<std::string> panoids,
+    ResultCallback on_result, bool keep_panorama) {
+    // The batch loop blocks while it waits for results, so it gets its own thread
+    begin_call();
+    return std::async(std::launch::async,
+        [this, panoids = std::move(panoids), on_result = std::move(on_result), keep_panorama]() {
+            struct CallScope {
+                StreetViewClient* client;
+                ~CallScope() { client->end_call(); }
+            } scope{ this };
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            return downloader->process_batch_to_memory(panoids, on_result, keep_panorama);
+        });
+}
+
+// Entry point of the command line tool; kept out of streetview.h, which only carries the
+// in-memory API
+int run_downloader_cli(int argc, char* argv[]) {
+    StreetViewDownloader downloader;
+    if (argc == 1) {
+        // No arguments: show the banner and usage
+        downloader.print_usage(argv[0]);
+        return 0;
     }
-}
\ No newline at end of file
+    return downloader.run(argc, argv);
+}